@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ * This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+/*
+ * Microbenchmarks for the parser without R
+ *
+ * Links against the R-free parts of the package (see src/parse.h) so that the
+ * hot loops can be run under `perf` or `valgrind --tool=cachegrind` directly.
+ * See the Makefile in this directory for how to build it.
+ *
+ *   parse_bench [-n bytes] [-r reps] [-s seed]
+ *
+ * Generates the same kinds of corpora as bench.R, each as a single string of
+ * about `bytes` bytes with a newline roughly every 80 columns, and writes CSV
+ * to stdout with the best of `reps` timings for each corpus and benchmark:
+ *
+ * - read_next: `FANSI_read_next` one character at a time.
+ * - read_ascii: runs of ASCII with `FANSI_read_ascii`, as the wrap code does,
+ *   and `FANSI_read_next` for everything else.
+ * - find_esc: `FANSI_find_esc` from one control sequence to the next, as the
+ *   strip and has code does.
+ * - csi_write: `FANSI_style_size` and `FANSI_csi_write` for each change of
+ *   style in the corpus (`ns.byte` is still per byte of the corpus).
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+
+// - Error interface -----------------------------------------------------------
+
+static long warnings = 0;
+
+void FANSI_error(const char * fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fputs("Error: ", stderr);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+  exit(1);
+}
+// Warnings are only counted, they would otherwise dominate the timings
+
+void FANSI_warning(const char * fmt, ...) {
+  (void) fmt;
+  ++warnings;
+}
+// - Corpora -------------------------------------------------------------------
+
+// xorshift64*, so corpora are the same on all platforms for a given seed
+
+static unsigned long long rng_state;
+static unsigned int rng(unsigned int n) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (unsigned int) ((rng_state * 2685821657736338717ULL) >> 33) % n;
+}
+static const char * words[] = {
+  "Lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+  "et", "dolore", "magna", "aliqua.", "Ut", "enim", "ad", "minim", "veniam,",
+  "quis", "nostrud", "exercitation", "ullamco", "laboris", "nisi"
+};
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static const char * bad[] = {
+  "\033[31", "\033[999m", "\033[38;5m", "\033[38;2;1;2m", "\033[1;2;x",
+  "\033", "\033]8;;http://x\a", "\033[?25h", "\033[2J", "\a"
+};
+#define BAD_COUNT (sizeof(bad) / sizeof(bad[0]))
+
+enum corpus {ASCII, CJK, SGR_DENSE, SGR_SPARSE, TRUECOLOR, MALFORMED};
+static const char * corpus_names[] = {
+  "ascii", "cjk", "sgr.dense", "sgr.sparse", "truecolor", "malformed"
+};
+#define CORPUS_COUNT (sizeof(corpus_names) / sizeof(corpus_names[0]))
+
+// Append a word along with any control sequences for the corpus type, and
+// return how many columns it takes up.
+
+static int add_word(char ** p, enum corpus type) {
+  int width = 0;
+  char * x = *p;
+  switch(type) {
+    case SGR_DENSE:
+      x += sprintf(x, "\033[38;5;%um", rng(256));
+      break;
+    case SGR_SPARSE:
+      if(!rng(10)) x += sprintf(x, "\033[38;5;%um", rng(256));
+      break;
+    case TRUECOLOR:
+      x += sprintf(
+        x, "\033[38;2;%u;%u;%u;48;2;%u;%u;%um",
+        rng(256), rng(256), rng(256), rng(256), rng(256), rng(256)
+      );
+      break;
+    case MALFORMED:
+      if(!rng(4)) x += sprintf(x, "%s", bad[rng(BAD_COUNT)]);
+      break;
+    default: break;
+  }
+  if(type == CJK) {
+    // Common CJK Unified Ideographs, 3 bytes in UTF-8 and 2 wide
+    int chars = 1 + rng(4);
+    for(int i = 0; i < chars; ++i) {
+      unsigned int cp = 0x4E00 + rng(0x1000);
+      *(x++) = (char) (0xE0 | (cp >> 12));
+      *(x++) = (char) (0x80 | ((cp >> 6) & 0x3F));
+      *(x++) = (char) (0x80 | (cp & 0x3F));
+      width += 2;
+    }
+  } else {
+    const char * w = words[rng(WORD_COUNT)];
+    size_t len = strlen(w);
+    memcpy(x, w, len);
+    x += len;
+    width = (int) len;
+  }
+  if(type == SGR_DENSE) x += sprintf(x, "\033[m");
+  else if(type == TRUECOLOR) x += sprintf(x, "\033[39;49m");
+  *p = x;
+  return width;
+}
+static char * make_corpus(enum corpus type, size_t bytes) {
+  // Words with their sequences are well under 256 bytes
+  char * res = malloc(bytes + 256);
+  if(!res) FANSI_error("failed to allocate corpus");
+  char * x = res;
+  int col = 0;
+  while((size_t) (x - res) < bytes) {
+    col += add_word(&x, type);
+    if(col >= 80) {
+      *(x++) = '\n';
+      col = 0;
+    } else {
+      *(x++) = rng(20) ? ' ' : '\t';
+      ++col;
+  } }
+  *x = 0;
+  return res;
+}
+// - Benchmarks ----------------------------------------------------------------
+
+static struct FANSI_state state_init(const char * x) {
+  return (struct FANSI_state) {
+    .string=x, .warn=1, .allowNA=1, .use_nchar=1,
+    .term_cap=FANSI_TERM_BRIGHT | FANSI_TERM_256 | FANSI_TERM_TRUECOLOR,
+    .ctl=FANSI_CTL_ALL
+  };
+}
+// Results are accumulated here so the compiler can't drop the loops
+
+static volatile long sink;
+
+static void bench_read_next(const char * x) {
+  struct FANSI_state state = state_init(x);
+  while(state.string[state.pos.byte]) FANSI_read_next(&state);
+  sink += state.pos.width;
+}
+static void bench_read_ascii(const char * x) {
+  struct FANSI_state state = state_init(x);
+  while(state.string[state.pos.byte]) {
+    if(!FANSI_read_ascii(&state, NULL, INT_MAX, 1)) FANSI_read_next(&state);
+  }
+  sink += state.pos.width;
+}
+static void bench_find_esc(const char * x) {
+  const char * end = x + strlen(x);
+  long found = 0;
+  while(1) {
+    struct FANSI_csi_pos pos = FANSI_find_esc(x, end, FANSI_CTL_ALL);
+    if(!pos.len) break;
+    x = pos.start + pos.len;
+    ++found;
+  }
+  sink += found;
+}
+static struct FANSI_style * styles;
+static size_t styles_len;
+static char * csi_buff;
+
+static void bench_csi_write(const char * x) {
+  (void) x;
+  long written = 0;
+  for(size_t i = 0; i < styles_len; ++i) {
+    int size = FANSI_style_size(styles[i]);
+    written += FANSI_csi_write(csi_buff, styles[i], size);
+  }
+  sink += written;
+}
+// Record each change of style to feed `bench_csi_write`
+
+static void grow_styles(size_t size) {
+  struct FANSI_style * styles_new =
+    realloc(styles, size * sizeof(struct FANSI_style));
+  if(!styles_new) FANSI_error("failed to allocate styles");
+  styles = styles_new;
+}
+static void collect_styles(const char * x) {
+  struct FANSI_state state = state_init(x);
+  size_t size = 1024;
+  styles_len = 0;
+  grow_styles(size);
+  struct FANSI_style prev = {0};
+  while(state.string[state.pos.byte]) {
+    FANSI_read_next(&state);
+    if(FANSI_style_comp(state.sgr, prev)) {
+      if(styles_len == size) grow_styles(size *= 2);
+      styles[styles_len++] = prev = state.sgr;
+  } }
+}
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+struct bench {const char * name; void (*fun)(const char *);};
+
+int main(int argc, char ** argv) {
+  size_t bytes = 1 << 20;
+  int reps = 10;
+  unsigned long long seed = 42;
+
+  for(int i = 1; i < argc; ++i) {
+    int has_val = i + 1 < argc;
+    if(has_val && !strcmp(argv[i], "-n")) bytes = strtoull(argv[++i], 0, 10);
+    else if(has_val && !strcmp(argv[i], "-r")) reps = atoi(argv[++i]);
+    else if(has_val && !strcmp(argv[i], "-s")) seed = strtoull(argv[++i], 0, 10);
+    else {
+      fprintf(stderr, "Usage: %s [-n bytes] [-r reps] [-s seed]\n", argv[0]);
+      return 2;
+  } }
+  if(!bytes || reps < 1 || bytes > (size_t) INT_MAX / 2)
+    FANSI_error("`-n` must be in [1, INT_MAX / 2] and `-r` positive.");
+
+  FANSI_init_simd();
+  rng_state = seed ? seed : 1;  // xorshift state must not be zero
+
+  // Largest possible SGR is well under 128 bytes
+
+  csi_buff = malloc(128);
+  struct bench benches[] = {
+    {"read_next", bench_read_next}, {"read_ascii", bench_read_ascii},
+    {"find_esc", bench_find_esc}, {"csi_write", bench_csi_write}
+  };
+  printf("corpus,bench,bytes,reps,min.ns,ns.byte\n");
+  for(size_t c = 0; c < CORPUS_COUNT; ++c) {
+    char * x = make_corpus((enum corpus) c, bytes);
+    size_t x_bytes = strlen(x);
+    collect_styles(x);
+
+    for(size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b) {
+      double best = -1;
+      benches[b].fun(x);  // warm up
+      for(int r = 0; r < reps; ++r) {
+        double start = now_ns();
+        benches[b].fun(x);
+        double time = now_ns() - start;
+        if(best < 0 || time < best) best = time;
+      }
+      printf(
+        "%s,%s,%zu,%d,%.0f,%.4f\n", corpus_names[c], benches[b].name,
+        x_bytes, reps, best, best / x_bytes
+      );
+    }
+    free(x);
+  }
+  free(styles);
+  free(csi_buff);
+  fprintf(stderr, "%ld warnings\n", warnings);
+  return 0;
+}
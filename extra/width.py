@@ -0,0 +1,79 @@
+# Generate `src/width.h`, the display width lookup table used by
+# `FANSI_utf8_width`.
+#
+# Run from the package root with:
+#
+#     python3 extra/width.py > src/width.h
+#
+# Widths follow the usual `wcwidth` conventions (and those of R's own
+# `Ri18n_wcwidth`), using the Unicode database bundled with Python:
+#
+# * Zero width: non-spacing and enclosing marks (Mn, Me), format characters
+#   (Cf) other than the soft hyphen, and the Hangul Jamo medial vowels and final
+#   consonants that combine with a preceding syllable.
+# * Double width: East Asian Wide (W) and Fullwidth (F) characters.
+# * Everything else is one wide, including unassigned code points outside of
+#   the blocks reserved for CJK ideographs.
+#
+# Only the zero and double width ranges are recorded; lookups that miss the
+# table are assumed to be one wide.
+
+import sys
+import unicodedata
+
+# Blocks where unassigned code points default to East Asian Wide
+
+CJK_DEFAULT_WIDE = (
+    (0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+    (0x20000, 0x2FFFD), (0x30000, 0x3FFFD)
+)
+
+def width(cp):
+    c = chr(cp)
+    cat = unicodedata.category(c)
+    if cat == 'Cn':
+        return 2 if any(lo <= cp <= hi for lo, hi in CJK_DEFAULT_WIDE) else 1
+    if (
+        (cat in ('Mn', 'Me') or (cat == 'Cf' and cp != 0x00AD)) or
+        0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF
+    ):
+        return 0
+    if unicodedata.east_asian_width(c) in ('W', 'F'):
+        return 2
+    return 1
+
+ranges = []
+for cp in range(0x80, 0x110000):
+    if 0xD800 <= cp <= 0xDFFF:
+        continue  # surrogates are never valid UTF-8
+    w = width(cp)
+    if w == 1:
+        continue
+    if ranges and ranges[-1][2] == w and ranges[-1][1] == cp - 1:
+        ranges[-1][1] = cp
+    else:
+        ranges.append([cp, cp, w])
+
+out = sys.stdout
+out.write(
+    "/*\n"
+    " * Generated by extra/width.py from Unicode %s, do not edit by hand.\n"
+    " *\n"
+    " * Sorted, non-overlapping code point ranges that are not one wide, as\n"
+    " * {first, last, width}.  See `FANSI_utf8_width`.\n"
+    " */\n\n"
+    "#define FANSI_WIDTH_RANGES %d\n"
+    "#define FANSI_WIDTH_MIN 0x%04X\n\n"
+    "static const struct FANSI_width_range {\n"
+    "  int lo;\n  int hi;\n  int width;\n"
+    "} FANSI_width_table[FANSI_WIDTH_RANGES] = {\n" %
+    (unicodedata.unidata_version, len(ranges), ranges[0][0])
+)
+for i in range(0, len(ranges), 3):
+    row = ranges[i:i + 3]
+    out.write(
+        "  " + " ".join(
+            "{0x%04X, 0x%04X, %d}," % tuple(r) for r in row
+        ) + "\n"
+    )
+out.write("};\n")
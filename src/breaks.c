@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ * This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include "fansi.h"
+
+/*
+ * Break indices
+ *
+ * Each element is indexed into an integer matrix with a row for each space,
+ * tab, or newline, and a final row for the end of the string.  The columns
+ * are (see BRK_*):
+ *
+ * * byte: bytes preceding the break character.
+ * * chr: characters preceding the break character, excluding Control
+ *   Sequences.
+ * * width: display width preceding the break character.
+ * * break.width: display width of the break character, 0 for the end row.
+ * * style: 1 based index into the "style" attribute of the matrix, which
+ *   contains the SGR sequences active at each break.  The first one is always
+ *   the empty string.
+ * * next: 1 based row index of the first newline or end row at or after the
+ *   current row.
+ *
+ * With this we can wrap at any width by looking up break positions instead of
+ * re-reading the string.
+ */
+#define BRK_BYTE 0
+#define BRK_CHR 1
+#define BRK_WIDTH 2
+#define BRK_BRK_WIDTH 3
+#define BRK_STYLE 4
+#define BRK_NEXT 5
+#define BRK_COLS 6
+
+struct brk_rows {int * x; int len; int size;};
+
+static void brk_add_row(
+  struct brk_rows * rows, struct FANSI_position pos, int brk_width, int style,
+  int next
+) {
+  if(rows->len >= rows->size) {
+    if(rows->size > FANSI_int_max / 2 / BRK_COLS)
+      error("Too many break positions to index.");  // nocov
+    int size_new = rows->size ? rows->size * 2 : 64;
+    int * x_new = (int *) R_alloc((size_t) size_new * BRK_COLS, sizeof(int));
+    if(rows->len)
+      memcpy(x_new, rows->x, (size_t) rows->len * BRK_COLS * sizeof(int));
+    rows->x = x_new;
+    rows->size = size_new;
+  }
+  int * row = rows->x + (size_t) rows->len * BRK_COLS;
+  row[BRK_BYTE] = pos.byte;
+  row[BRK_CHR] = pos.raw;
+  row[BRK_WIDTH] = pos.width;
+  row[BRK_BRK_WIDTH] = brk_width;
+  row[BRK_STYLE] = style;
+  row[BRK_NEXT] = next;
+  ++rows->len;
+}
+/*
+ * Distinct styles of an element in order of first appearance.  Elements
+ * usually have few distinct styles so we just search them in sequence.
+ */
+struct brk_styles {struct FANSI_style * x; int len; int size;};
+
+static int brk_style(struct brk_styles * styles, struct FANSI_style style) {
+  // Most of the time the style is the same as the last one
+  if(!FANSI_style_comp(style, styles->x[styles->len - 1]))
+    return styles->len;
+  for(int i = 0; i < styles->len - 1; ++i)
+    if(!FANSI_style_comp(style, styles->x[i])) return i + 1;
+
+  if(styles->len >= styles->size) {
+    int size_new = styles->size * 2;
+    struct FANSI_style * x_new = (struct FANSI_style *)
+      R_alloc(size_new, sizeof(struct FANSI_style));
+    memcpy(x_new, styles->x, styles->len * sizeof(struct FANSI_style));
+    styles->x = x_new;
+    styles->size = size_new;
+  }
+  styles->x[styles->len++] = style;
+  return styles->len;
+}
+static SEXP brk_index(
+  struct FANSI_state state, struct brk_rows * rows,
+  struct brk_styles * styles, SEXP dimnames
+) {
+  rows->len = 0;
+  styles->len = 1;
+  styles->x[0] = (struct FANSI_style){0};
+
+  while(1) {
+    FANSI_read_ascii(&state, NULL, FANSI_int_max, 0);
+    char chr = state.string[state.pos.byte];
+    if(!chr) break;
+    if(chr == ' ' || chr == '\t' || chr == '\n') {
+      // Record the position before the break character
+      struct FANSI_position pos = state.pos;
+      int style = brk_style(styles, state.sgr);
+      FANSI_read_next(&state);
+      brk_add_row(
+        rows, pos, state.pos.width - pos.width, style, -(chr == '\n')
+      );
+    } else FANSI_read_next(&state);
+  }
+  brk_add_row(rows, state.pos, 0, brk_style(styles, state.sgr), -1);
+
+  // Fill in the next newline or end row, going backwards
+
+  int next = rows->len;
+  for(int i = rows->len - 1; i >= 0; --i) {
+    int * row = rows->x + (size_t) i * BRK_COLS;
+    if(row[BRK_NEXT] < 0) next = i + 1;
+    row[BRK_NEXT] = next;
+  }
+  // Transpose into an R matrix
+
+  SEXP res = PROTECT(allocMatrix(INTSXP, rows->len, BRK_COLS));
+  int * res_int = INTEGER(res);
+  for(int i = 0; i < rows->len; ++i)
+    for(int j = 0; j < BRK_COLS; ++j)
+      res_int[(R_xlen_t) j * rows->len + i] =
+        rows->x[(size_t) i * BRK_COLS + j];
+
+  SEXP res_style = PROTECT(allocVector(STRSXP, styles->len));
+  for(int i = 0; i < styles->len; ++i)
+    SET_STRING_ELT(res_style, i, mkChar(FANSI_style_as_chr(styles->x[i])));
+  setAttrib(res, R_DimNamesSymbol, dimnames);
+  setAttrib(res, FANSI_style_sym, res_style);
+  UNPROTECT(2);
+  return res;
+}
+/*
+ * Compute the break index of each element of a character vector
+ *
+ * @param x a character vector in UTF-8.
+ * @return a list with, for each element of `x`, NULL if it is NA, or the
+ *   break index matrix described above.
+ */
+SEXP FANSI_wrap_breaks(SEXP x, SEXP warn, SEXP term_cap, SEXP ctl) {
+  if(TYPEOF(x) != STRSXP)
+    error("Internal Error: `x` must be character");  // nocov
+
+  R_xlen_t x_len = XLENGTH(x);
+  SEXP R_true = PROTECT(ScalarLogical(1));
+  SEXP R_one = PROTECT(ScalarInteger(1));
+  struct FANSI_state state_init = FANSI_state_init_full(
+    "", warn, term_cap, R_true, R_true, R_one, ctl
+  );
+  SEXP res = PROTECT(allocVector(VECSXP, x_len));
+
+  const char * col_names[BRK_COLS] = {
+    "byte", "chr", "width", "break.width", "style", "next"
+  };
+  SEXP dimnames = PROTECT(allocVector(VECSXP, 2));
+  SEXP dimnames_col = PROTECT(allocVector(STRSXP, BRK_COLS));
+  for(int j = 0; j < BRK_COLS; ++j)
+    SET_STRING_ELT(dimnames_col, j, mkChar(col_names[j]));
+  SET_VECTOR_ELT(dimnames, 1, dimnames_col);
+
+  struct brk_rows rows = {.len=0, .size=0};
+  struct brk_styles styles = {.len=0, .size=8};
+  styles.x = (struct FANSI_style *) R_alloc(styles.size, sizeof(*styles.x));
+
+  for(R_xlen_t i = 0; i < x_len; ++i) {
+    FANSI_interrupt(i);
+    SEXP chr = STRING_ELT(x, i);
+    if(chr == NA_STRING) continue;
+    FANSI_check_enc(chr, i);
+
+    struct FANSI_state state = state_init;
+    state.string = CHAR(chr);
+    SET_VECTOR_ELT(res, i, brk_index(state, &rows, &styles, dimnames));
+  }
+  UNPROTECT(5);
+  return res;
+}
+/*
+ * Wrap strings using break indices
+ *
+ * Lines are filled greedily: each line ends at the last break that keeps it
+ * within `width`, at a newline, or if no break fits at the first break.  The
+ * break character is dropped and everything else, including any other
+ * whitespace, is kept.  Since the widths in the index are non-decreasing we
+ * can binary search them, so each line costs O(log(breaks)).
+ *
+ * The index is validated as we use it so that bad indices cannot cause
+ * out-of-bounds reads.
+ *
+ * @param x a character vector in UTF-8.
+ * @param breaks a list of the same length as `x` as produced by
+ *   FANSI_wrap_breaks.
+ * @param width scalar integer, the maximum display width of lines.
+ */
+SEXP FANSI_wrap_at_breaks(SEXP x, SEXP breaks, SEXP width) {
+  if(
+    TYPEOF(x) != STRSXP || TYPEOF(breaks) != VECSXP ||
+    XLENGTH(x) != XLENGTH(breaks)
+  )
+    error("Internal Error: bad `x` or `breaks`");  // nocov
+  if(TYPEOF(width) != INTSXP || XLENGTH(width) != 1)
+    error("Internal Error: `width` must be scalar integer");  // nocov
+
+  R_xlen_t x_len = XLENGTH(x);
+  int width_int = asInteger(width);
+  SEXP res = PROTECT(allocVector(VECSXP, x_len));
+  struct FANSI_buff buff = {.len=0};
+  const char * bad_index = "Invalid break index for element %.0f.";
+
+  for(R_xlen_t i = 0; i < x_len; ++i) {
+    FANSI_interrupt(i);
+    SEXP chr = STRING_ELT(x, i);
+    SEXP brk = VECTOR_ELT(breaks, i);
+    if(chr == NA_STRING) continue;
+    FANSI_check_enc(chr, i);
+
+    SEXP dim = getAttrib(brk, R_DimSymbol);
+    SEXP style = getAttrib(brk, FANSI_style_sym);
+    if(
+      TYPEOF(brk) != INTSXP || TYPEOF(dim) != INTSXP || XLENGTH(dim) != 2 ||
+      INTEGER(dim)[0] < 1 || INTEGER(dim)[1] != BRK_COLS ||
+      TYPEOF(style) != STRSXP || !XLENGTH(style)
+    )
+      error(bad_index, (double) i + 1);
+
+    const char * string = CHAR(chr);
+    int bytes = LENGTH(chr);
+    int rows = INTEGER(dim)[0];
+    int * byte = INTEGER(brk) + (R_xlen_t) BRK_BYTE * rows;
+    int * wide = INTEGER(brk) + (R_xlen_t) BRK_WIDTH * rows;
+    int * brk_wide = INTEGER(brk) + (R_xlen_t) BRK_BRK_WIDTH * rows;
+    int * sgr = INTEGER(brk) + (R_xlen_t) BRK_STYLE * rows;
+    int * next = INTEGER(brk) + (R_xlen_t) BRK_NEXT * rows;
+    R_xlen_t styles = XLENGTH(style);
+
+    // First pass counts lines, second writes them
+
+    SEXP res_i = R_NilValue;
+    for(int pass = 0; pass < 2; ++pass) {
+      int row_s = 0, byte_s = 0, width_s = 0, sgr_s = 1, line = 0;
+      while(1) {
+        if(
+          row_s >= rows || next[row_s] <= row_s || next[row_s] > rows
+        )
+          error(bad_index, (double) i + 1);
+        int last = next[row_s] - 1;
+
+        // Last row that fits, or the first one if none do
+
+        int lo = row_s, hi = last, j = row_s;
+        while(lo <= hi) {
+          int mid = lo + (hi - lo) / 2;
+          if((double) wide[mid] - width_s <= width_int) {
+            j = mid;
+            lo = mid + 1;
+          } else hi = mid - 1;
+        }
+        if(
+          byte[j] < byte_s || byte[j] > bytes || sgr[j] < 1 ||
+          sgr[j] > styles || sgr_s > styles
+        )
+          error(bad_index, (double) i + 1);
+
+        if(pass) {
+          const char * sgr_start = CHAR(STRING_ELT(style, sgr_s - 1));
+          int bytes_start = strlen(sgr_start);
+          int bytes_body = byte[j] - byte_s;
+          int bytes_stop = sgr[j] > 1 ? 4 : 0;
+          if(bytes_body > FANSI_int_max - bytes_start - bytes_stop)
+            error(
+              "Wrapped line longer than INT_MAX in element %.0f.",
+              (double) i + 1
+            );
+          FANSI_size_buff(
+            &buff, (size_t) bytes_start + bytes_body + bytes_stop + 1
+          );
+          char * buff_track = buff.buff;
+          memcpy(buff_track, sgr_start, bytes_start);
+          buff_track += bytes_start;
+          memcpy(buff_track, string + byte_s, bytes_body);
+          buff_track += bytes_body;
+          if(bytes_stop) {
+            memcpy(buff_track, "\033[0m", bytes_stop);
+            buff_track += bytes_stop;
+          }
+          *buff_track = 0;
+          SET_STRING_ELT(
+            res_i, line,
+            mkCharLenCE(
+              buff.buff, (int) (buff_track - buff.buff), getCharCE(chr)
+          ) );
+        }
+        ++line;
+        if(j == rows - 1) break;
+
+        // Next line starts after the break character
+
+        byte_s = byte[j] + 1;
+        width_s = wide[j] + brk_wide[j];
+        sgr_s = sgr[j];
+        row_s = j + 1;
+      }
+      if(!pass) {
+        res_i = PROTECT(allocVector(STRSXP, line));
+        SET_VECTOR_ELT(res, i, res_i);
+        UNPROTECT(1);
+    } }
+  }
+  UNPROTECT(1);
+  return res;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ * This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include "fansi.h"
+
+/*
+ * Wrap cache
+ *
+ * Least recently used cache of the wrapped lines of strings, keyed on the
+ * CHARSXP address of the input string, the wrap settings, and whether the
+ * string was the first element of its vector (and thus used `initial`).  Equal
+ * strings share the same CHARSXP in R's global CHARSXP cache, and we keep a
+ * reference to the key CHARSXPs so their addresses cannot be re-used while
+ * they are in the cache.
+ *
+ * Settings are interned in a short list, and each entry refers to its
+ * settings by index so that keys stay small.  We clear the whole cache in the
+ * unlikely event that there are more than CACHE_SET_MAX distinct settings.
+ *
+ * The R objects (keys, values, and settings) live in a list that is preserved
+ * from garbage collection, and the rest in memory allocated with R_Calloc.
+ * The cache must only be used from the main thread.
+ */
+#define CACHE_SET_MAX 32
+#define CACHE_SIZE_INIT 256
+// Rough size of the header of an R vector
+#define CACHE_OVERHEAD 56
+
+struct cache_ent {
+  SEXP chr;
+  int settings, first;
+  int hash_next;   // next entry in hash bucket, or -1
+  int prev, next;  // more and less recently used entries, or -1
+  double bytes;
+};
+static struct {
+  struct cache_ent * ent;
+  int * bucket;
+  int size, len, free;
+  int head, tail;  // most and least recently used entries
+  double budget, bytes, hits, misses;
+  SEXP store;      // list of keys, values, and settings
+} cache = {
+  .ent=NULL, .bucket=NULL, .size=0, .len=0, .free=-1, .head=-1, .tail=-1,
+  .budget=0, .bytes=0, .hits=0, .misses=0, .store=NULL
+};
+
+static size_t cache_hash(SEXP chr, int settings, int first) {
+  uintptr_t h = ((uintptr_t) chr >> 4) ^
+    ((uintptr_t) settings << 1 | (uintptr_t) first);
+  h *= (uintptr_t) 0x9E3779B97F4A7C15ULL;
+  return (size_t) (h >> 16) & (size_t) (cache.size * 2 - 1);
+}
+static void cache_lru_unlink(int i) {
+  struct cache_ent * ent = cache.ent + i;
+  if(ent->prev >= 0) cache.ent[ent->prev].next = ent->next;
+  else cache.head = ent->next;
+  if(ent->next >= 0) cache.ent[ent->next].prev = ent->prev;
+  else cache.tail = ent->prev;
+}
+static void cache_lru_push(int i) {
+  struct cache_ent * ent = cache.ent + i;
+  ent->prev = -1;
+  ent->next = cache.head;
+  if(cache.head >= 0) cache.ent[cache.head].prev = i;
+  cache.head = i;
+  if(cache.tail < 0) cache.tail = i;
+}
+static void cache_evict(int i) {
+  struct cache_ent * ent = cache.ent + i;
+  int * link = cache.bucket + cache_hash(ent->chr, ent->settings, ent->first);
+  while(*link != i) link = &cache.ent[*link].hash_next;
+  *link = ent->hash_next;
+  cache_lru_unlink(i);
+
+  SET_STRING_ELT(VECTOR_ELT(cache.store, 0), i, NA_STRING);
+  SET_VECTOR_ELT(VECTOR_ELT(cache.store, 1), i, R_NilValue);
+  cache.bytes -= ent->bytes;
+  ent->chr = NA_STRING;
+  ent->next = cache.free;
+  cache.free = i;
+  --cache.len;
+}
+static void cache_clear() {
+  if(cache.store) R_ReleaseObject(cache.store);
+  if(cache.ent) R_Free(cache.ent);
+  if(cache.bucket) R_Free(cache.bucket);
+  cache.ent = NULL;
+  cache.bucket = NULL;
+  cache.store = NULL;
+  cache.size = cache.len = 0;
+  cache.free = cache.head = cache.tail = -1;
+  cache.bytes = 0;
+}
+static void cache_grow() {
+  if(cache.size > INT_MAX / 4)
+    error("Internal Error: wrap cache too large.");  // nocov
+  int size = cache.size ? cache.size * 2 : CACHE_SIZE_INIT;
+
+  if(!cache.store) {
+    cache.store = allocVector(VECSXP, 3);
+    R_PreserveObject(cache.store);
+    SET_VECTOR_ELT(cache.store, 2, allocVector(VECSXP, 0));
+  }
+  SEXP keys = PROTECT(allocVector(STRSXP, size));
+  SEXP vals = PROTECT(allocVector(VECSXP, size));
+  for(int i = 0; i < size; ++i) SET_STRING_ELT(keys, i, NA_STRING);
+  for(int i = 0; i < cache.size; ++i) {
+    SET_STRING_ELT(keys, i, STRING_ELT(VECTOR_ELT(cache.store, 0), i));
+    SET_VECTOR_ELT(vals, i, VECTOR_ELT(VECTOR_ELT(cache.store, 1), i));
+  }
+  SET_VECTOR_ELT(cache.store, 0, keys);
+  SET_VECTOR_ELT(cache.store, 1, vals);
+  UNPROTECT(2);
+
+  cache.ent = cache.ent ?
+    R_Realloc(cache.ent, size, struct cache_ent) :
+    R_Calloc(size, struct cache_ent);
+  if(cache.bucket) R_Free(cache.bucket);
+  cache.bucket = R_Calloc((size_t) size * 2, int);
+
+  // Add the new entries to the free list, and rehash the existing ones
+
+  for(int i = size - 1; i >= cache.size; --i) {
+    cache.ent[i].chr = NA_STRING;
+    cache.ent[i].next = cache.free;
+    cache.free = i;
+  }
+  cache.size = size;
+  for(int i = 0; i < size * 2; ++i) cache.bucket[i] = -1;
+  for(int i = 0; i < size; ++i) {
+    struct cache_ent * ent = cache.ent + i;
+    if(ent->chr == NA_STRING) continue;
+    int * bucket = cache.bucket + cache_hash(ent->chr, ent->settings, ent->first);
+    ent->hash_next = *bucket;
+    *bucket = i;
+  }
+}
+/*
+ * Set the cache budget and find the index of the wrap settings
+ *
+ * @param budget the maximum approximate memory in bytes to use for the cache,
+ *   if zero the cache is cleared.
+ * @param sig integer vector that captures all the scalar settings.
+ * @param prefix, initial the CHARSXPs of `prefix` and `initial`.
+ * @return the index of the settings, or -1 if the cache is disabled.
+ */
+int FANSI_cache_settings(double budget, SEXP sig, SEXP prefix, SEXP initial) {
+  if(TYPEOF(sig) != INTSXP)
+    error("Internal Error: bad cache signature.");  // nocov
+
+  cache.budget = budget > 0 ? budget : 0;
+  if(!cache.budget) {
+    cache_clear();
+    return -1;
+  }
+  while(cache.bytes > cache.budget) cache_evict(cache.tail);
+  if(!cache.store) cache_grow();
+
+  SEXP settings = VECTOR_ELT(cache.store, 2);
+  R_xlen_t set_len = XLENGTH(settings);
+  for(R_xlen_t i = 0; i < set_len; ++i) {
+    SEXP set = VECTOR_ELT(settings, i);
+    SEXP sig_i = VECTOR_ELT(set, 0);
+    if(
+      STRING_ELT(VECTOR_ELT(set, 1), 0) == prefix &&
+      STRING_ELT(VECTOR_ELT(set, 1), 1) == initial &&
+      XLENGTH(sig_i) == XLENGTH(sig) &&
+      !memcmp(INTEGER(sig_i), INTEGER(sig), XLENGTH(sig) * sizeof(int))
+    )
+      return (int) i;
+  }
+  if(set_len >= CACHE_SET_MAX) {
+    cache_clear();
+    cache_grow();
+    settings = VECTOR_ELT(cache.store, 2);
+    set_len = 0;
+  }
+  SEXP set = PROTECT(allocVector(VECSXP, 2));
+  SEXP pre = PROTECT(allocVector(STRSXP, 2));
+  SET_STRING_ELT(pre, 0, prefix);
+  SET_STRING_ELT(pre, 1, initial);
+  SET_VECTOR_ELT(set, 0, duplicate(sig));
+  SET_VECTOR_ELT(set, 1, pre);
+
+  SEXP settings_new = PROTECT(allocVector(VECSXP, set_len + 1));
+  for(R_xlen_t i = 0; i < set_len; ++i)
+    SET_VECTOR_ELT(settings_new, i, VECTOR_ELT(settings, i));
+  SET_VECTOR_ELT(settings_new, set_len, set);
+  SET_VECTOR_ELT(cache.store, 2, settings_new);
+  UNPROTECT(3);
+  return (int) set_len;
+}
+/*
+ * @param settings as returned by FANSI_cache_settings, must not be -1.
+ * @param first whether `chr` is the first element of the input.
+ * @return the cached value, or NULL if there is none.
+ */
+SEXP FANSI_cache_get(SEXP chr, int settings, int first) {
+  int i = cache.bucket[cache_hash(chr, settings, first)];
+  while(i >= 0) {
+    struct cache_ent * ent = cache.ent + i;
+    if(ent->chr == chr && ent->settings == settings && ent->first == first)
+      break;
+    i = ent->hash_next;
+  }
+  if(i < 0) {
+    ++cache.misses;
+    return NULL;
+  }
+  ++cache.hits;
+  cache_lru_unlink(i);
+  cache_lru_push(i);
+  return VECTOR_ELT(VECTOR_ELT(cache.store, 1), i);
+}
+/*
+ * Add a value to the cache, evicting least recently used values as needed to
+ * stay within the budget.  Values larger than the budget are not added.
+ *
+ * @param val a character vector, which becomes shared with the cache.
+ */
+void FANSI_cache_set(SEXP chr, int settings, int first, SEXP val) {
+  if(TYPEOF(val) != STRSXP)
+    error("Internal Error: can only cache character vectors.");  // nocov
+
+  R_xlen_t val_len = XLENGTH(val);
+  double bytes = CACHE_OVERHEAD + sizeof(struct cache_ent) + 3 * sizeof(int) +
+    (double) val_len * sizeof(SEXP);
+  for(R_xlen_t i = 0; i < val_len; ++i)
+    bytes += CACHE_OVERHEAD + LENGTH(STRING_ELT(val, i)) + 1;
+  if(bytes > cache.budget) return;
+
+  while(cache.bytes + bytes > cache.budget) cache_evict(cache.tail);
+  if(cache.free < 0) cache_grow();
+
+  int i = cache.free;
+  struct cache_ent * ent = cache.ent + i;
+  cache.free = ent->next;
+  *ent = (struct cache_ent) {
+    .chr=chr, .settings=settings, .first=first, .bytes=bytes
+  };
+  int * bucket = cache.bucket + cache_hash(chr, settings, first);
+  ent->hash_next = *bucket;
+  *bucket = i;
+  cache_lru_push(i);
+
+  // The value is now referenced from both the cache and the result
+
+#ifdef MARK_NOT_MUTABLE
+  MARK_NOT_MUTABLE(val);
+#else
+  SET_NAMED(val, 2);
+#endif
+  SET_STRING_ELT(VECTOR_ELT(cache.store, 0), i, chr);
+  SET_VECTOR_ELT(VECTOR_ELT(cache.store, 1), i, val);
+  cache.bytes += bytes;
+  ++cache.len;
+}
+/*
+ * Cache statistics for R, optionally clearing the cache and resetting the
+ * counters.
+ */
+SEXP FANSI_cache_info_ext(SEXP clear) {
+  if(TYPEOF(clear) != LGLSXP || XLENGTH(clear) != 1)
+    error("Internal Error: `clear` must be TRUE or FALSE.");  // nocov
+
+  const char * names[5] = {"hits", "misses", "entries", "bytes", "budget"};
+  double vals[5] = {
+    cache.hits, cache.misses, cache.len, cache.bytes, cache.budget
+  };
+  SEXP res = PROTECT(allocVector(REALSXP, 5));
+  SEXP res_names = PROTECT(allocVector(STRSXP, 5));
+  for(int i = 0; i < 5; ++i) {
+    REAL(res)[i] = vals[i];
+    SET_STRING_ELT(res_names, i, mkChar(names[i]));
+  }
+  setAttrib(res, R_NamesSymbol, res_names);
+  if(asLogical(clear)) {
+    cache_clear();
+    cache.hits = cache.misses = 0;
+  }
+  UNPROTECT(2);
+  return res;
+}
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ *  This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "parse.h"
+
+// Writing and comparing SGR styles
+
+/*
+ * We always include the size of the delimiter; could be a problem that this
+ * isn't the actual size, but rather the maximum size (i.e. we always assume
+ * three bytes even if the numbers don't get into three digits).
+ *
+ * @param bg whether this is a background color
+ */
+static int color_size(uint32_t color, int bg) {
+  int size = 0;
+  uint32_t val = FANSI_CLR_VAL(color);
+  switch(FANSI_CLR_TYPE(color)) {
+    case 0: break;
+    case FANSI_CLR_8: size = 3; break;
+    case FANSI_CLR_BRIGHT: size = bg ? 4 : 3; break;
+    case FANSI_CLR_256:
+      size = 3 + 2 + FANSI_digits_in_int((int) val) + 1;
+      break;
+    case FANSI_CLR_TRU:
+      size = 3 + 2 +
+        FANSI_digits_in_int((int) (val >> 16)) + 1 +
+        FANSI_digits_in_int((int) (val >> 8 & 0xFF)) + 1 +
+        FANSI_digits_in_int((int) (val & 0xFF)) + 1;
+      break;
+    default:
+      FANSI_error("Internal Error: unexpected color format"); // nocov
+  }
+  return size;
+}
+/*
+ * Computes how many bytes we need to write out a style
+ *
+ * No overflow worries here b/c ints are 32bit+
+ *
+ * Includes the ESC[m size, but not the NULL terminator, so if you are writing
+ * to a string that has nothing else in it remember to allocate an extra byte
+ * for the NULL terminator.
+ */
+int FANSI_style_size(struct FANSI_style sgr) {
+  int size = 0;
+  if(FANSI_style_has(sgr)) {
+    int color_sz = color_size(sgr.color, 0);
+    int bg_color_sz = color_size(sgr.bg_color, 1);
+
+    // styles are stored as bits, styles less than 10 correspond to 0-9, the
+    // others are random ones but will need one more byte, hence the
+    // `(2 + (i > 9))`
+
+    int style_size = 0;
+    if(sgr.style) {
+      for(int i = 1; i <= FANSI_STYLE_MAX; ++i){
+        style_size +=
+          ((sgr.style & (1 << i)) > 0) *
+          (2 + (i > 9));
+    } }
+    // Some question of whether we are adding a slowdown to check for rarely use
+    // ESC sequences such as these...
+
+    // Border
+
+    int border_size = 0;
+    if(sgr.border) {
+      for(int i = 1; i < 4; ++i){
+        border_size += ((sgr.border & (1 << i)) > 0) * 3;
+      }
+    }
+    // Ideogram
+
+    int ideogram_size = 0;
+    if(sgr.ideogram) {
+      for(int i = 0; i < 5; ++i){
+        ideogram_size += ((sgr.ideogram & (1 << i)) > 0) * 3;
+      }
+    }
+    // font
+
+    int font_size = 0;
+    if(sgr.font) font_size = 3;
+
+    size += color_sz + bg_color_sz + style_size +
+      border_size + ideogram_size + font_size + 2; // +2 for ESC[
+  }
+  return size;
+}
+/*
+ * Write extra color info to string
+ *
+ * Modifies string by reference.  This assumes that we're not in a no color
+ * state that shouldn't have color.
+ *
+ * String should be a pointer to the location we want to start writing, so
+ * should already be offset.  The return value is the offset from the original
+ * position
+ */
+static unsigned int color_write(char * string, uint32_t color, int mode) {
+  if(mode != 3 && mode != 4)
+    FANSI_error("Internal Error: color mode must be 3 or 4");  // nocov
+
+  unsigned int str_off = 0;
+  uint32_t val = FANSI_CLR_VAL(color);
+  int write_chrs = 0;
+
+  switch(FANSI_CLR_TYPE(color)) {
+    case 0: break;
+    case FANSI_CLR_8:
+      string[str_off++] = mode == 3 ? '3' : '4';
+      string[str_off++] = '0' + val;
+      string[str_off++] = ';';
+      break;
+    case FANSI_CLR_BRIGHT:
+      if(mode == 3) {
+        string[str_off++] = '9';
+      } else {
+        string[str_off++] = '1';
+        string[str_off++] = '0';
+      }
+      string[str_off++] = '0' + val;
+      string[str_off++] = ';';
+      break;
+    case FANSI_CLR_256:
+    case FANSI_CLR_TRU:
+      string[str_off++] = mode == 3 ? '3' : '4';
+      string[str_off++] = '8';
+      string[str_off++] = ';';
+
+      if(FANSI_CLR_TYPE(color) == FANSI_CLR_TRU) {
+        write_chrs = sprintf(
+          string + str_off, "2;%d;%d;%d;",
+          (int) (val >> 16), (int) (val >> 8 & 0xFF), (int) (val & 0xFF)
+        );
+      } else {
+        write_chrs = sprintf(string + str_off, "5;%d;", (int) val);
+      }
+      if(write_chrs < 0)
+        FANSI_error("Internal Error: failed writing color code.");  // nocov
+      str_off += write_chrs;
+      break;
+    default:
+      FANSI_error("Internal Error: unexpected color code.");  // nocov
+  }
+  return str_off;
+}
+/*
+ * We split this part out because in some cases we want to modify pre-existing
+ * buffers
+ *
+ * Modifies the buffer by reference.
+ *
+ * DOES NOT ADD NULL TERMINATOR.
+ *
+ * return how many bytes were written
+ */
+int FANSI_csi_write(char * buff, struct FANSI_style sgr, int buff_len) {
+  /****************************************************\
+  | IMPORTANT: KEEP THIS ALIGNED WITH state_as_html    |
+  | although right now ignoring rare escapes in html   |
+  \****************************************************/
+
+  int str_pos = 0;
+
+  if(FANSI_style_has(sgr)) {
+    buff[str_pos++] = 27;    // ESC
+    buff[str_pos++] = '[';
+    // styles
+
+    for(int i = 1; i < 10; i++) {
+      if((1 << i) & sgr.style) {
+        buff[str_pos++] = '0' + i;
+        buff[str_pos++] = ';';
+    } }
+    // styles outside 0-9
+
+    if(sgr.style & (1 << 10)) {
+      // fraktur
+      buff[str_pos++] = '2';
+      buff[str_pos++] = '0';
+      buff[str_pos++] = ';';
+    }
+    if(sgr.style & (1 << 11)) {
+      // double underline
+      buff[str_pos++] = '2';
+      buff[str_pos++] = '1';
+      buff[str_pos++] = ';';
+    }
+    if(sgr.style & (1 << 12)) {
+      // prop spacing
+      buff[str_pos++] = '2';
+      buff[str_pos++] = '6';
+      buff[str_pos++] = ';';
+    }
+    // colors
+
+    str_pos += color_write(&(buff[str_pos]), sgr.color, 3);
+    str_pos += color_write(&(buff[str_pos]), sgr.bg_color, 4);
+
+    // Borders
+
+    if(sgr.border) {
+      for(int i = 1; i < 4; ++i){
+        if((1 << i) & sgr.border) {
+          buff[str_pos++] = '5';
+          buff[str_pos++] = '0' + i;
+          buff[str_pos++] = ';';
+    } } }
+    // Ideogram
+
+    if(sgr.ideogram) {
+      for(int i = 0; i < 5; ++i){
+        if((1 << i) & sgr.ideogram) {
+          buff[str_pos++] = '6';
+          buff[str_pos++] = '0' + i;
+          buff[str_pos++] = ';';
+    } } }
+    // font
+
+    if(sgr.font) {
+      buff[str_pos++] = '1';
+      buff[str_pos++] = '0' + (sgr.font % 10);
+      buff[str_pos++] = ';';
+    }
+    // Finalize
+
+    if(str_pos != buff_len)
+      // nocov start
+      // note this error is really too late, as we could have written past
+      // allocation in the steps above
+      FANSI_error(
+        "Internal Error: tag mem allocation mismatch (%u, %u)",
+        str_pos, buff_len
+      );
+      // nocov end
+    buff[str_pos - 1] = 'm';
+  }
+  return str_pos;
+}
+/*
+ * Determine whether two styles are the same
+ *
+ * Returns 1 if the are different, 0 if they are equal.
+ *
+ * _basic is used just for the 1-9 SGR codes plus colors.
+ */
+int FANSI_style_comp_basic(
+  struct FANSI_style target, struct FANSI_style current
+) {
+  // 1023 is '11 1111 1111' in binary, so this will grab the last ten bits
+  // of the styles which are the 1-9 styles
+  return !(
+    (target.style & 1023) == (current.style & 1023) &&
+    target.color == current.color &&
+    target.bg_color == current.bg_color
+  );
+}
+int FANSI_style_comp(struct FANSI_style target, struct FANSI_style current) {
+  return memcmp(&target, &current, sizeof(struct FANSI_style)) != 0;
+}
+int FANSI_style_has(struct FANSI_style sgr) {
+  static const struct FANSI_style none = {0};
+  return FANSI_style_comp(sgr, none);
+}
+int FANSI_style_has_basic(struct FANSI_style sgr) {
+  return sgr.style || sgr.color || sgr.bg_color;
+}
+/*
+ * Compute how many digits are in a number
+ *
+ * Add an extra character for negative integers.
+ */
+
+int FANSI_digits_in_int(int x) {
+  int num = 1;
+  if(x < 0) {
+    ++num;
+    x = -x;
+  }
+  while((x = (x / 10))) ++num;
+  return num;
+}
@@ -22,20 +22,38 @@
 
 #include "fansi.h"
 
+/*
+ * Does not use the R API so it is safe to call from worker threads.
+ *
+ * @return 1 if there is a control sequence, -1 if there is one but it is
+ *   invalid, and 0 otherwise.
+ */
+static int has_chr(const char * chr, const char * end, int ctl) {
+  struct FANSI_csi_pos pos = FANSI_find_esc(chr, end, ctl);
+  return (pos.valid ? 1 : -1) * (pos.len != 0);
+}
 int FANSI_has_int(SEXP x, int ctl) {
   if(TYPEOF(x) != CHARSXP) error("Argument `x` must be CHRSXP.");
   if(x == NA_STRING) return NA_LOGICAL;
-  else {
-    struct FANSI_csi_pos pos = FANSI_find_esc(CHAR(x), ctl);
-    return (pos.valid ? 1 : -1) * (pos.len != 0);
-  }
+  else return has_chr(CHAR(x), CHAR(x) + LENGTH(x), ctl);
+}
+static void has_warn(R_xlen_t i) {
+  warning(
+    "Encountered invalid ESC sequence at index [%.0f], %s%s",
+    (double) i + 1,
+    "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
+    "off these warnings."
+  );
+}
+static void has_check_args(SEXP x, SEXP ctl) {
+  if(TYPEOF(x) != STRSXP) error("Argument `x` must be character.");
+  if(TYPEOF(ctl) != INTSXP) error("Internal Error: `ctl` must be INTSXP.");
 }
 /*
  * Check if a CHARSXP contains ANSI esc sequences
  */
 SEXP FANSI_has(SEXP x, SEXP ctl, SEXP warn) {
-  if(TYPEOF(x) != STRSXP) error("Argument `x` must be character.");
-  if(TYPEOF(ctl) != INTSXP) error("Internal Error: `ctl` must be INTSXP.");
+  has_check_args(x, ctl);
   R_xlen_t len = XLENGTH(x);
 
   SEXP res = PROTECT(allocVector(LGLSXP, len));
@@ -52,16 +70,76 @@ SEXP FANSI_has(SEXP x, SEXP ctl, SEXP warn) {
     // no great, but need to watch out for NA_LOGICAL == INT_MIN
     if(res_tmp == -1 && warn_int) {
       res_tmp = -res_tmp;
-      warning(
-        "Encountered invalid ESC sequence at index [%.0f], %s%s",
-        (double) i + 1,
-        "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
-        "off these warnings."
-      );
+      has_warn(i);
     }
     res_int[i] = res_tmp;
   }
   UNPROTECT(1);
   return res;
 }
+/*
+ * Multi-threaded version of `FANSI_has`
+ *
+ * The scan runs in parallel directly over the `CHAR` data, which is read-only,
+ * and fills in the result vector and the index of the first invalid sequence.
+ * Encoding checks and warnings happen afterwards on the main thread, in the
+ * same order as they would in `FANSI_has`.
+ *
+ * Falls back to `FANSI_has` if the package was built without OpenMP, or if
+ * there is only one thread.
+ *
+ * @param threads scalar integer number of threads to use.
+ */
+SEXP FANSI_has_ext(SEXP x, SEXP ctl, SEXP warn, SEXP threads) {
+  if(TYPEOF(threads) != INTSXP || XLENGTH(threads) != 1)
+    error("Internal Error: `threads` should be scalar integer.");  // nocov
+  int threads_int = asInteger(threads);
+  has_check_args(x, ctl);
+  R_xlen_t len = XLENGTH(x);
 
+#ifndef _OPENMP
+  threads_int = 1;
+#endif
+  if(threads_int < 2 || len < 2) return FANSI_has(x, ctl, warn);
+
+  int warn_int = asLogical(warn);
+  int ctl_int = FANSI_ctl_as_int(ctl);
+
+  const char ** chrs = (const char **) R_alloc(len, sizeof(const char *));
+  int * lens = (int *) R_alloc(len, sizeof(int));
+
+  for(R_xlen_t i = 0; i < len; ++i) {
+    FANSI_interrupt(i);
+    SEXP chrsxp = STRING_ELT(x, i);
+    if(chrsxp == NA_STRING) {
+      chrs[i] = NULL;
+      lens[i] = 0;
+    } else {
+      chrs[i] = CHAR(chrsxp);
+      lens[i] = LENGTH(chrsxp);
+  } }
+  SEXP res = PROTECT(allocVector(LGLSXP, len));
+  int * res_int = LOGICAL(res);
+  R_xlen_t invalid_first = len;
+  R_xlen_t i;
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads_int) schedule(dynamic, 256) \
+    reduction(min:invalid_first)
+#endif
+  for(i = 0; i < len; ++i) {
+    if(chrs[i]) {
+      res_int[i] = has_chr(chrs[i], chrs[i] + lens[i], ctl_int);
+      if(res_int[i] == -1 && i < invalid_first) invalid_first = i;
+    } else res_int[i] = NA_LOGICAL;
+  }
+  for(i = 0; i < len; ++i) {
+    FANSI_interrupt(i);
+    FANSI_check_enc(STRING_ELT(x, i), i);
+    if(i >= invalid_first && res_int[i] == -1 && warn_int) {
+      res_int[i] = 1;
+      has_warn(i);
+  } }
+  UNPROTECT(1);
+  return res;
+}
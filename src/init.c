@@ -21,23 +21,26 @@
 
 static const
 R_CallMethodDef callMethods[] = {
-  {"has_csi", (DL_FUNC) &FANSI_has, 3},
-  {"strip_csi", (DL_FUNC) &FANSI_strip, 3},
-  {"strwrap_csi", (DL_FUNC) &FANSI_strwrap_ext, 15},
+  {"has_csi", (DL_FUNC) &FANSI_has_ext, 4},
+  {"strip_csi", (DL_FUNC) &FANSI_strip_ext, 4},
+  {"strwrap_csi", (DL_FUNC) &FANSI_strwrap_ext, 18},
+  {"strtrim", (DL_FUNC) &FANSI_strtrim, 7},
+  {"wrap_breaks", (DL_FUNC) &FANSI_wrap_breaks, 4},
+  {"wrap_at_breaks", (DL_FUNC) &FANSI_wrap_at_breaks, 3},
+  {"cache_info", (DL_FUNC) &FANSI_cache_info_ext, 1},
   {"state_at_pos_ext", (DL_FUNC) &FANSI_state_at_pos_ext, 8},
+  {"substr", (DL_FUNC) &FANSI_substr, 9},
   {"process", (DL_FUNC) &FANSI_process_ext, 1},
   {"check_assumptions", (DL_FUNC) &FANSI_check_assumptions, 0},
   {"digits_in_int", (DL_FUNC) &FANSI_digits_in_int_ext, 1},
   {"tabs_as_spaces", (DL_FUNC) &FANSI_tabs_as_spaces_ext, 5},
   {"color_to_html", (DL_FUNC) &FANSI_color_to_html_ext, 1},
-  {"esc_to_html", (DL_FUNC) &FANSI_esc_to_html, 3},
+  {"esc_to_html", (DL_FUNC) &FANSI_esc_to_html, 4},
   {"unhandled_esc", (DL_FUNC) &FANSI_unhandled_esc, 2},
-  {"unique_chr", (DL_FUNC) &FANSI_unique_chr, 1},
   {"nzchar_esc", (DL_FUNC) &FANSI_nzchar, 5},
+  {"nchar_esc", (DL_FUNC) &FANSI_nchar, 6},
   {"add_int", (DL_FUNC) &FANSI_add_int_ext, 2},
-  {"strsplit", (DL_FUNC) &FANSI_strsplit, 3},
-  {"cleave", (DL_FUNC) &FANSI_cleave, 1},
-  {"order", (DL_FUNC) &FANSI_order, 1},
+  {"strsplit", (DL_FUNC) &FANSI_strsplit, 6},
   {"sort_int", (DL_FUNC) &FANSI_sort_int, 1},
   {"sort_chr", (DL_FUNC) &FANSI_sort_chr, 1},
   {"set_int_max", (DL_FUNC) &FANSI_set_int_max, 1},
@@ -48,6 +51,8 @@ R_CallMethodDef callMethods[] = {
 };
 
 SEXP FANSI_warn_sym;
+SEXP FANSI_style_sym;
+SEXP FANSI_carry_sym;
 
 void R_init_fansi(DllInfo *info)
 {
@@ -60,5 +65,8 @@ void R_init_fansi(DllInfo *info)
   R_forceSymbols(info, FALSE);
 
   FANSI_warn_sym = install("warn");
+  FANSI_style_sym = install("style");
+  FANSI_carry_sym = install("carry");
+  FANSI_init_simd();
 }
 
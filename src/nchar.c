@@ -53,9 +53,11 @@ SEXP FANSI_nzchar(
       // Don't bother converting to UTF8
 
       const char * string = CHAR(string_elt);
+      const char * string_end = string + LENGTH(string_elt);
 
       while((*string > 0 && *string < 32) || *string == 127) {
-        struct FANSI_csi_pos pos = FANSI_find_esc(string, FANSI_CTL_ALL);
+        struct FANSI_csi_pos pos =
+          FANSI_find_esc(string, string_end, FANSI_CTL_ALL);
         if(
           warn_int && !warned && (!pos.valid || (pos.ctl & FANSI_CTL_ESC))
         ) {
@@ -83,3 +85,95 @@ SEXP FANSI_nzchar(
   UNPROTECT(1);
   return res;
 }
+/*
+ * Count characters, display width, or bytes, excluding Control Sequences
+ *
+ * Equivalent to `nchar(strip_ctl(x, ctl, warn), type, allowNA, keepNA)`, but
+ * we count the text between Control Sequences directly instead of making
+ * stripped copies of the strings.
+ *
+ * @param type 0 for chars, 1 for width, 2 for bytes.
+ * @param allowNA whether to return NA instead of an error for invalid UTF-8.
+ * @param keepNA see `nchar`.
+ */
+SEXP FANSI_nchar(
+  SEXP x, SEXP type, SEXP allowNA, SEXP keepNA, SEXP warn, SEXP ctl
+) {
+  if(
+    TYPEOF(x) != STRSXP ||
+    TYPEOF(type) != INTSXP || XLENGTH(type) != 1 ||
+    TYPEOF(allowNA) != LGLSXP || XLENGTH(allowNA) != 1 ||
+    TYPEOF(keepNA) != LGLSXP || XLENGTH(keepNA) != 1 ||
+    TYPEOF(warn) != LGLSXP || XLENGTH(warn) != 1 ||
+    TYPEOF(ctl) != INTSXP
+  )
+    error("Internal error: input type error; contact maintainer"); // nocov
+
+  int type_int = asInteger(type);
+  int allowNA_int = asLogical(allowNA);
+  int keepNA_int = asLogical(keepNA);
+  int warn_int = asLogical(warn);
+  int ctl_int = FANSI_ctl_as_int(ctl);
+  R_xlen_t invalid_idx = 0;
+
+  // Like `nchar`, NAs are 2 ("NA") if `keepNA` is FALSE, or if it is NA and
+  // we are counting width
+
+  int na_val = keepNA_int == 1 || (keepNA_int == NA_LOGICAL && type_int != 1) ?
+    NA_INTEGER : 2;
+
+  R_xlen_t x_len = XLENGTH(x);
+  SEXP res = PROTECT(allocVector(INTSXP, x_len));
+  int * res_int = INTEGER(res);
+
+  for(R_xlen_t i = 0; i < x_len; ++i) {
+    FANSI_interrupt(i);
+    SEXP x_chr = STRING_ELT(x, i);
+    if(x_chr == NA_STRING) {
+      res_int[i] = na_val;
+      continue;
+    }
+    FANSI_check_enc(x_chr, i);
+
+    const char * chr = CHAR(x_chr);
+    const char * end = chr + LENGTH(x_chr);
+    int count = 0;
+
+    // Count each run of text between the Control Sequences we are stripping
+
+    while(chr < end) {
+      struct FANSI_csi_pos csi = FANSI_find_esc(chr, end, ctl_int);
+      if(
+        !invalid_idx && (!csi.valid || ((csi.ctl & FANSI_CTL_ESC) & ctl_int))
+      )
+        invalid_idx = i + 1;
+
+      const char * run_end = csi.len ? csi.start : end;
+      int bytes = (int) (run_end - chr);
+      int run = bytes;
+      if(type_int == 0) run = FANSI_utf8_chars(chr, bytes);
+      else if(type_int == 1) run = FANSI_utf8_width(chr, bytes);
+
+      if(run == NA_INTEGER) {
+        if(!allowNA_int)
+          error("invalid multibyte string, element %.0f", (double) i + 1);
+        count = NA_INTEGER;
+        break;
+      }
+      count += run;
+      if(!csi.len) break;
+      chr = csi.start + csi.len;
+    }
+    res_int[i] = count;
+  }
+  // `nchar` keeps these attributes
+
+  SEXP attr_syms[3] = {R_NamesSymbol, R_DimSymbol, R_DimNamesSymbol};
+  for(int j = 0; j < 3; ++j) {
+    SEXP attr = getAttrib(x, attr_syms[j]);
+    if(attr != R_NilValue) setAttrib(res, attr_syms[j], attr);
+  }
+  if(invalid_idx) FANSI_strip_warn(res, warn_int, invalid_idx);
+  UNPROTECT(1);
+  return res;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ *  This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+
+#ifndef _FANSI_PARSE_H
+#define _FANSI_PARSE_H
+
+  /*
+   * The parser proper (reading control sequences and characters, computing
+   * display widths, writing SGR sequences) does not use the R API so that it
+   * can be compiled without R, e.g. by bench/parse_bench.c.  Everything it
+   * needs is declared here, and fansi.h includes this file.
+   */
+
+  // - Constants / Macros ------------------------------------------------------
+
+  // CAREFUL with these; if we get close to INT_MAX with 2^x we can have
+  // problems with signed/unsigned bit shifts.  Shouldn't be anywhere close to
+  // that but something to keep in mind
+
+  #define FANSI_CTL_NL 1
+  #define FANSI_CTL_C0 2
+  #define FANSI_CTL_SGR 4
+  #define FANSI_CTL_CSI 8
+  #define FANSI_CTL_ESC 16
+  #define FANSI_CTL_ALL 31 // 1 + 2 + 4 + 8 + 16 == 2^0 + 2^1 + 2^2 + 2^3 + 2^4
+
+  #define FANSI_STYLE_MAX 12 // 12 is double underline
+
+  #define FANSI_TERM_BRIGHT 1
+  #define FANSI_TERM_256 2
+  #define FANSI_TERM_TRUECOLOR 4
+
+  // `FANSI_state.warn` value to record but not issue warnings
+  #define FANSI_WARN_DEFER 2
+
+  // Same value as R's NA_INTEGER
+
+  #define FANSI_NA_INT INT_MIN
+
+  #if defined(__GNUC__)
+  #define FANSI_NORETURN __attribute__((noreturn))
+  #else
+  #define FANSI_NORETURN
+  #endif
+
+  // - Structs -----------------------------------------------------------------
+
+  /*
+   * Used when computing position and size of ANSI tag with FANSI_loc
+   */
+
+  struct FANSI_csi_pos {
+    // Pointer to the first ESC, or NULL, if it is not found
+    const char * start;
+    // how many characters to the end of the sequnce
+    int len;
+    // whether the sequnce is complete or not
+    int valid;
+    // what types of control sequences were found, seel also FANSI_state.ctl
+    int ctl;
+  };
+
+  /*
+   * Encoded colors
+   *
+   * Each color is stored in a single 32 bit word, with the color type in the
+   * high byte and the color value in the low three bytes:
+   *
+   * - FANSI_CLR_8: the basic colors from the 3[0-7] and 4[0-7] SGR codes, value
+   *   is the 0-7 color number.
+   * - FANSI_CLR_BRIGHT: the 9[0-7] and 10[0-7] bright colors, value is the 0-7
+   *   color number.
+   * - FANSI_CLR_256: the [34]8;5;n 256 color palette codes, value is n.
+   * - FANSI_CLR_TRU: the [34]8;2;r;g;b true color codes, value is r, g, and b
+   *   in that order from the high to low byte.
+   *
+   * A value of zero means no color is set.
+   */
+  #define FANSI_CLR_8 1U
+  #define FANSI_CLR_BRIGHT 2U
+  #define FANSI_CLR_256 3U
+  #define FANSI_CLR_TRU 4U
+
+  #define FANSI_CLR(type, val) (((uint32_t) (type) << 24) | (uint32_t) (val))
+  #define FANSI_CLR_TYPE(x) ((x) >> 24)
+  #define FANSI_CLR_VAL(x) ((x) & 0xFFFFFFU)
+
+  /*
+   * The SGR style at any particular position in a string.  Note this is only
+   * designed to capture SGR CSI codes (i.e. those of format "ESC[n;n;n;m")
+   * where "n" is a number.  This is a small subset of the possible ANSI escape
+   * codes.
+   *
+   * This is kept compact and free of padding so that styles can be copied
+   * cheaply and compared with `memcmp`; zero means no style.
+   */
+  struct FANSI_style {
+    // See FANSI_CLR_* above
+    uint32_t color;
+    uint32_t bg_color;
+    /*
+     * should be interpreted as bit mask where with 2^n., 1-9 match to the
+     * corresponding ANSI CSI SGR codes, 10 and greater are not necessarily
+     * contiguous but were put here because they could co-exist with the style
+     *
+     * - n ==  1: bold
+     * - n ==  2: blur/faint
+     * - n ==  3: italic
+     * - n ==  4: underline
+     * - n ==  5: blink slow
+     * - n ==  6: blink fast
+     * - n ==  7: invert
+     * - n ==  8: conceal
+     * - n ==  9: crossout
+     * - n == 10: fraktur
+     * - n == 11: double underline
+     * - n == 12: prop spacing
+     *
+     * UPDATE FANSI_STYLE_MAX if we add more here!!, make sure to check the
+     * size, read, and write funs any time this changes
+     */
+    uint32_t style;
+    /*
+     * should be interpreted as bit mask where with 2^n.
+     *
+     * - n == 1: framed
+     * - n == 2: encircled
+     * - n == 3: overlined
+     */
+    uint16_t border;
+    /*
+     * should be interpreted as bit mask where with 2^n.
+     *
+     * - n == 0: ideogram underline or right side line
+     * - n == 1: ideogram double underline or double line on the right side
+     * - n == 2: ideogram overline or left side line
+     * - n == 3: ideogram double overline or double line on the left side
+     * - n == 4: ideogram stress marking
+     */
+    uint8_t ideogram;
+    // Alternative fonts, 10-19, where 0 is the primary font
+    uint8_t font;
+  };
+  /*
+   * Position markers (all zero index), we use int because these numbers
+   * need to make it back to R which doesn't have a `size_t` type.
+   *
+   * - byte: the byte in the string
+   * - ansi: actual character position, different from byte due to
+   *   multi-byte characters (i.e. UTF-8)
+   * - raw: the character position after we strip the handled ANSI tags,
+   *   the difference with ansi is that ansi counts the escaped
+   *   characters whereas this one does not.
+   * - width: the character postion accounting for double width
+   *   characters, etc., note in this case ASCII escape sequences are treated
+   *   as zero chars.  Width is computed with FANSI_utf8_width.
+   * - width_target: width when the requested width cannot be matched
+   *   exactly, width is the exact width, and this one is what was
+   *   actually requested.  Needed so we can match back to request.
+   *
+   * Actually not clear if there is a difference b/w raw and ansi,
+   * might need to remove one
+   */
+  struct FANSI_position {
+    int byte;
+    int ansi;
+    int raw;
+    int width;
+    int width_target;
+  };
+  /*
+   * Captures the ANSI state at any particular position in a string: the style,
+   * the position, and the control flags used while reading.
+   */
+  struct FANSI_state {
+    struct FANSI_style sgr;
+    struct FANSI_position pos;
+
+    /*
+     * The original string the state corresponds to.  This should always be
+     * a pointer to the beginning of the string, use the
+     * `state.string[state.pos.byte]` to access the current position.
+     */
+    const char * string;
+    /*
+     * Any error associated with err_code
+     */
+    const char * err_msg;
+
+    // Are there bytes outside of 0-127
+
+    int has_utf8;
+
+    // Track width of last character (this seems to be the display width)
+
+    int last_char_width;
+
+    /* Control Flags -----------------------------------------------------------
+     *
+     * Used to communicate back from sub-processes that sub-parsing failed, the
+     * sub-process is supposed to leave the state pointed at the failing
+     * character with the byte position updated.  The parent process is then in
+     * charge of updating the raw position.
+     */
+    /*
+     * Type of failure
+     *
+     * * 0: no error
+     * * 1: well formed csi sgr, but contains uninterpretable sub-strings, if a
+     *      CSI sequence is not fully parsed yet (i.e. last char not read) it is
+     *      assumed to be SGR until we read the final code.
+     * * 2: well formed csi sgr, but contains uninterpretable characters [:<=>]
+     * * 3: well formed csi sgr, but contains color codes that exceed terminal
+     *     capabilities
+     * * 4: well formed csi, but not an SGR
+     * * 5: malformed csi
+     * * 6: other escape sequence
+     * * 7: malformed escape
+     * * 8: c0 escapes
+     * * 9: malformed UTF8
+     */
+    int err_code;
+    /*
+     * Terminal capabilities
+     *
+     * term_cap & 1        // bright colors
+     * term_cap & (1 << 1) // 256 colors
+     * term_cap & (1 << 2) // true color
+     *
+     */
+    int term_cap;
+    // Whether at end of a CSI escape sequence
+    int last;
+    // Whether the last control sequence that was completely read is known to be
+    // an SGR sequence.  This is used as part of the `read_esc` process and is
+    // really intended to be internal.  It's really only meaningful when
+    // `state.last` is true.
+    int is_sgr;
+    // Whether to issue warnings if err_code is non-zero, if -1 means that the
+    // warning was issued at least once so may not need to be re-issued.  If
+    // FANSI_WARN_DEFER the warning is not issued, but `warn` still becomes
+    // negative, which allows reading off of the main thread.
+    int warn;
+    // Whether to compute display width, really only needed when we're doing
+    // things in width mode
+    int use_nchar;
+
+    /*
+     * These support the arguments of the same names for nchar
+     */
+    int allowNA;
+    int keepNA;
+    // invalid multi-byte char, a bit of duplication with err_code = 9;
+    int nchar_err;
+    // what types of Control Sequences should have special treatment.  This
+    // mirrors the `ctl` parameter for `FANSI_find_esc`.  See `FANSI_ctl_as_int`
+    // for the encoding.
+    int ctl;
+  };
+  /*
+   * Need to keep track of fallback state, so we need ability to return two
+   * states
+   */
+  struct FANSI_state_pair {
+    struct FANSI_state cur;
+    struct FANSI_state prev;
+  };
+  // - Errors ------------------------------------------------------------------
+  /*
+   * The parser reports errors and warnings through these, with `printf` style
+   * formats.  `FANSI_error` must not return.  In the package they forward to
+   * R's `error` and `warning` (see utils.c); programs that use the parser
+   * without R must define them.
+   */
+  void FANSI_error(const char * fmt, ...) FANSI_NORETURN;
+  void FANSI_warning(const char * fmt, ...);
+
+  // - Functions ---------------------------------------------------------------
+
+  struct FANSI_csi_pos FANSI_find_esc(
+    const char * x, const char * end, int ctl
+  );
+  void FANSI_init_simd();
+  int FANSI_utf8clen(char c);
+  int FANSI_utf8_width(const char * x, int bytes);
+  int FANSI_utf8_chars(const char * x, int bytes);
+  int FANSI_digits_in_int(int x);
+  int FANSI_style_comp(struct FANSI_style target, struct FANSI_style current);
+  int FANSI_style_comp_basic(
+    struct FANSI_style target, struct FANSI_style current
+  );
+  int FANSI_style_has(struct FANSI_style style);
+  int FANSI_style_has_basic(struct FANSI_style style);
+  int FANSI_style_size(struct FANSI_style style);
+  int FANSI_csi_write(char * buff, struct FANSI_style style, int buff_len);
+  void FANSI_read_next(struct FANSI_state * state);
+  int FANSI_read_ascii(
+    struct FANSI_state * state, struct FANSI_state * prev, int max, int space
+  );
+  int FANSI_has_utf8(const char * x);
+
+#endif
@@ -16,7 +16,12 @@
  * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
  */
 
-#include "fansi.h"
+#include "parse.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(FANSI_NO_SIMD)
+#define FANSI_X86_SIMD
+#include <immintrin.h>
+#endif
 
 // Can a byte be interpreted as ASCII number?
 
@@ -29,7 +34,7 @@ static int is_num(const char * string) {
 static int as_num(const char * string) {
   if(!is_num(string))
     // nocov start
-    error(
+    FANSI_error(
       "Internal Error: attempt to convert non-numeric char (%d) to int.",
       (int) *string
     );
@@ -39,17 +44,8 @@ static int as_num(const char * string) {
 /*
  * Reset all the display attributes, but not the position ones
  */
-static struct FANSI_state reset_state(struct FANSI_state state) {
-  state.style = 0;
-  state.color = -1;
-  for(int i = 0; i < 4; i++) state.color_extra[i] = 0;
-  state.bg_color = -1;
-  for(int i = 0; i < 4; i++) state.bg_color_extra[i] = 0;
-  state.border = 0;
-  state.ideogram = 0;
-  state.font = 0;
-
-  return  state;
+static void reset_state(struct FANSI_state * state) {
+  state->sgr = (struct FANSI_style) {0};
 }
 // Store the result of reading a parameter substring token
 
@@ -160,101 +156,137 @@ struct FANSI_tok_res FANSI_parse_token(const char * string) {
  * @param mode is whether we are doing foregrounds (3) or backgrounds (4)
  * @param colors is whether we are doing palette (5), or rgb truecolor (2)
  */
-static struct FANSI_state parse_colors(
-  struct FANSI_state state, int mode
-) {
+static void parse_colors(struct FANSI_state * state, int mode) {
   if(mode != 3 && mode != 4)
-    error("Internal Error: parsing color with invalid mode.");  // nocov
+    FANSI_error("Internal Error: parsing color with invalid mode.");  // nocov
 
   struct FANSI_tok_res res;
   int rgb[4] = {0};
-  int col = 8;
   int i_max;
 
   // First, figure out if we are in true color or palette mode
 
-  res = FANSI_parse_token(&state.string[state.pos_byte]);
-  state.pos_byte += res.len;
-  state.last = res.last;
-  state.err_code = res.err_code;
-  state.sgr = res.sgr;
+  res = FANSI_parse_token(&state->string[state->pos.byte]);
+  state->pos.byte += res.len;
+  state->last = res.last;
+  state->err_code = res.err_code;
+  state->is_sgr = res.sgr;
 
-  if(!state.err_code) {
-    if((res.val != 2 && res.val != 5) || state.last) {
+  if(!state->err_code) {
+    if((res.val != 2 && res.val != 5) || state->last) {
       // weird case, we don't want to advance the position here because
       // `res.val` needs to be interpreted as potentially a non-color style and
       // the prior 38 or 48 just gets tossed (at least this happens on OSX
       // terminal and iTerm)
 
-      state.pos_byte -= (res.len);
-      state.err_code = 1;
+      state->pos.byte -= (res.len);
+      state->err_code = 1;
     } else if (
       // terminal doesn't have 256 or true color capability
-      (res.val == 2 && !(state.term_cap & FANSI_TERM_TRUECOLOR)) ||
-      (res.val == 5 && !(state.term_cap & FANSI_TERM_256))
+      (res.val == 2 && !(state->term_cap & FANSI_TERM_TRUECOLOR)) ||
+      (res.val == 5 && !(state->term_cap & FANSI_TERM_256))
     ) {
       // right now this is same as when not 2/5 following a 38, but maybe in the
       // future we want different treatment?
-      state.pos_byte -= (res.len);
-      state.err_code = 3;
+      state->pos.byte -= (res.len);
+      state->err_code = 3;
     } else {
       int colors = res.val;
       if(colors == 2) {
         i_max = 3;
       } else if (colors == 5) {
         i_max = 1;
-      } else error("Internal Error: 1301341"); // nocov
+      } else FANSI_error("Internal Error: 1301341"); // nocov
 
       rgb[0] = colors;
 
       // Parse through the subsequent tokens
 
       for(int i = 0; i < i_max; ++i) {
-        res = FANSI_parse_token(&state.string[state.pos_byte]);
-        state.pos_byte += res.len;
-        state.last = res.last;
-        state.err_code = res.err_code;
-        state.sgr = res.sgr;
-
-        if(!state.err_code) {
+        res = FANSI_parse_token(&state->string[state->pos.byte]);
+        state->pos.byte += res.len;
+        state->last = res.last;
+        state->err_code = res.err_code;
+        state->is_sgr = res.sgr;
+
+        if(!state->err_code) {
+          // Sequences that end before all the color values are read, or that
+          // have values out of range, cannot be interpreted
           int early_end = res.last && i < (i_max - 1);
           if(res.val < 256 && !early_end) {
             rgb[i + 1] = res.val;
           } else {
-            // nocov start
-            error(
-              "Internal Error: invalid color without err_code; ",
-              "contact maintainer."
-            );
-            // nocov end
+            state->err_code = 1;
+            break;
           }
         } else break;
       }
       // If there is an error code we do not change the color
 
-      if(!state.err_code) {
-        if(mode == 3) {
-          state.color = col;
-          for(int i = 0; i < 4; i++) state.color_extra[i] = rgb[i];
-        } else if (mode == 4) {
-          state.bg_color = col;
-          for(int i = 0; i < 4; i++) state.bg_color_extra[i] = rgb[i];
-        }
+      if(!state->err_code) {
+        uint32_t color = colors == 2 ?
+          FANSI_CLR(FANSI_CLR_TRU, rgb[1] << 16 | rgb[2] << 8 | rgb[3]) :
+          FANSI_CLR(FANSI_CLR_256, rgb[1]);
+        if(mode == 3) state->sgr.color = color;
+        else state->sgr.bg_color = color;
   } } }
-  return state;
 }
 /*
  * Read a Character Off when we know it is an ascii char, this is so we have a
  * consistent way of advancing state.
  */
-static struct FANSI_state read_ascii(struct FANSI_state state) {
-  ++state.pos_byte;
-  ++state.pos_ansi;
-  ++state.pos_raw;
-  ++state.pos_width;
-  ++state.pos_width_target;
-  state.last_char_width = 1;
-  return state;
+static void read_ascii(struct FANSI_state * state) {
+  ++state->pos.byte;
+  ++state->pos.ansi;
+  ++state->pos.raw;
+  ++state->pos.width;
+  ++state->pos.width_target;
+  state->last_char_width = 1;
+}
+/*
+ * Read a run of printable ASCII characters in one step
+ *
+ * Equivalent to calling `FANSI_read_next` once for each character in the run,
+ * but without the per character dispatch.  Since all these characters are one
+ * wide, `max` can be used to stop exactly at a target character or width
+ * position.
+ *
+ * @param prev if not NULL, will be set to the state prior to reading the last
+ *   character of the run, i.e. what it would have been had we read the
+ *   characters one at a time.  Untouched if no characters are read.
+ * @param max the most characters to read.
+ * @param space whether spaces are part of the run (1) or end it (0).
+ * @return how many characters were read.
+ */
+int FANSI_read_ascii(
+  struct FANSI_state * state, struct FANSI_state * prev, int max, int space
+) {
+  const char * start = state->string + state->pos.byte;
+  const char lo = space ? 0x20 : 0x21;
+  int n = 0;
+
+  while(n < max && start[n] >= lo && start[n] < 0x7F) ++n;
+  if(n) {
+    if(prev) {
+      *prev = *state;
+      if(n > 1) {
+        prev->err_code = 0;
+        prev->pos.byte += n - 1;
+        prev->pos.ansi += n - 1;
+        prev->pos.raw += n - 1;
+        prev->pos.width += n - 1;
+        prev->pos.width_target += n - 1;
+        prev->last_char_width = 1;
+    } }
+    state->err_code = 0;
+    state->pos.byte += n;
+    state->pos.ansi += n;
+    state->pos.raw += n;
+    state->pos.width += n;
+    state->pos.width_target += n;
+    state->last_char_width = 1;
+  }
+  return n;
 }
 /*
  * Parses ESC sequences
@@ -303,22 +335,23 @@ static struct FANSI_state read_ascii(struct FANSI_state state) {
  * interpreted as the C0 ESC sequences they are and then the parsing of the CSI
  * string continues uninterrupted.
  *
- * @input state must be set with .pos_byte pointing to the ESC that begins the
+ * @input state must be set with .pos.byte pointing to the ESC that begins the
  *   CSI sequence
- * @return a state updated with the SGR sequence info and with pos_byte and
- *   other position info moved to the first char after the sequence.  See
+ * @return nothing, `state` is updated in place with the SGR sequence info and
+ *   with pos.byte and other position info moved to the first char after the
+ *   sequence.  See
  *   details for failure modes.
  */
-static struct FANSI_state read_esc(struct FANSI_state state) {
+static void read_esc(struct FANSI_state * state) {
   /***************************************************\
   | IMPORTANT: KEEP THIS ALIGNED WITH FANSI_find_esc  |
   \***************************************************/
-  if(state.string[state.pos_byte] != 27)
+  if(state->string[state->pos.byte] != 27)
     // nocov start
-    error(
+    FANSI_error(
       "Internal error: %s (decimal char %d).",
       "parsing ESC sequence that doesn't start with ESC",
-      (int) state.string[state.pos_byte]
+      (int) state->string[state->pos.byte]
     );
     // nocov end
 
@@ -329,19 +362,19 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
   // they are active via `ctl`, but the impossibility of knowing what type of
   // ESC sequence we're dealing with until we've parsed it.
 
-  while(state.string[state.pos_byte] == 27) {
-    struct FANSI_state state_prev = state;
+  while(state->string[state->pos.byte] == 27) {
+    struct FANSI_state state_prev = *state;
     int esc_recognized = 0;
 
-    ++state.pos_byte;  // advance ESC
+    ++state->pos.byte;  // advance ESC
 
-    if(!state.string[state.pos_byte]) {
+    if(!state->string[state->pos.byte]) {
       // String ends in ESC
-      state.err_code = 7;
+      state->err_code = 7;
       esc_recognized =
-        state.ctl & (FANSI_CTL_ESC | FANSI_CTL_CSI | FANSI_CTL_SGR);
+        state->ctl & (FANSI_CTL_ESC | FANSI_CTL_CSI | FANSI_CTL_SGR);
     } else if(
-      state.string[state.pos_byte] != '[' && state.ctl & FANSI_CTL_ESC
+      state->string[state->pos.byte] != '[' && state->ctl & FANSI_CTL_ESC
     ) {
       esc_recognized = 1;
 
@@ -351,37 +384,37 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
       // well...
 
       if(
-        state.string[state.pos_byte] >= 0x40 &&
-        state.string[state.pos_byte] <= 0x7E
+        state->string[state->pos.byte] >= 0x40 &&
+        state->string[state->pos.byte] <= 0x7E
       )
-        state.err_code = 6; else state.err_code = 7;
+        state->err_code = 6; else state->err_code = 7;
 
       // Don't process additional ESC if it is there so we keep looping
 
-      if(state.string[state.pos_byte] != 27)
-        ++state.pos_byte;
+      if(state->string[state->pos.byte] != 27)
+        ++state->pos.byte;
     } else if(
-      state.ctl & (FANSI_CTL_CSI | FANSI_CTL_SGR)
+      state->ctl & (FANSI_CTL_CSI | FANSI_CTL_SGR)
     ) {
       // CSI sequence
 
-      ++state.pos_byte;  // consume '['
+      ++state->pos.byte;  // consume '['
       struct FANSI_tok_res tok_res = {.err_code = 0};
 
       // Loop through the SGR; each token we process successfully modifies state
       // and advances to the next token
 
       do {
-        tok_res = FANSI_parse_token(&state.string[state.pos_byte]);
-        state.pos_byte += tok_res.len;
-        state.last = tok_res.last;
-        state.err_code = tok_res.err_code;
-        state.sgr = tok_res.sgr;
+        tok_res = FANSI_parse_token(&state->string[state->pos.byte]);
+        state->pos.byte += tok_res.len;
+        state->last = tok_res.last;
+        state->err_code = tok_res.err_code;
+        state->is_sgr = tok_res.sgr;
 
-        // Note we use `state.err_code` instead of `tok_res.err_code` as
+        // Note we use `state->err_code` instead of `tok_res.err_code` as
         // parse_colors internally calls FANSI_parse_token
 
-        if(!state.err_code) {
+        if(!state->err_code) {
           // We have a reasonable CSI value, now we need to check whether it
           // actually corresponds to anything that should modify state
           //
@@ -390,49 +423,49 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
           // properties to make sure...
 
           if(!tok_res.val) {
-            state = reset_state(state);
+            reset_state(state);
           } else if (tok_res.val < 10) {
             // 1-9 are the standard styles (bold/italic)
             // We use a bit mask on to track these
-            state.style |= 1U << tok_res.val;
+            state->sgr.style |= 1U << tok_res.val;
           } else if (tok_res.val < 20) {
             // These are alternative fonts
             if(tok_res.val == 10) {
-              state.font = 0;
+              state->sgr.font = 0;
             } else {
-              state.font = tok_res.val;
+              state->sgr.font = tok_res.val;
             }
           } else if (tok_res.val == 20) {
             // Fraktur
-            state.style |= (1U << 10U);
+            state->sgr.style |= (1U << 10U);
           } else if (tok_res.val == 21) {
             // Double underline
-            state.style |= (1U << 11U);
+            state->sgr.style |= (1U << 11U);
           } else if (tok_res.val == 22) {
             // Turn off bold or faint
-            state.style &= ~(1U << 1U);
-            state.style &= ~(1U << 2U);
+            state->sgr.style &= ~(1U << 1U);
+            state->sgr.style &= ~(1U << 2U);
           } else if (tok_res.val == 23) {
             // Turn off italics, fraktur
-            state.style &= ~(1U << 3U);
-            state.style &= ~(1U << 10U);
+            state->sgr.style &= ~(1U << 3U);
+            state->sgr.style &= ~(1U << 10U);
           } else if (tok_res.val == 24) {
             // Turn off underline, double underline
-            state.style &= ~(1U << 4U);
-            state.style &= ~(1U << 11U);
+            state->sgr.style &= ~(1U << 4U);
+            state->sgr.style &= ~(1U << 11U);
           } else if (tok_res.val == 25) {
             // Turn off blinking
-            state.style &= ~(1U << 5U);
-            state.style &= ~(1U << 6U);
+            state->sgr.style &= ~(1U << 5U);
+            state->sgr.style &= ~(1U << 6U);
           } else if (tok_res.val == 26) {
             // reserved for proportional spacing as specified in CCITT
             // Recommendation T.61; implicitly we are assuming this is a single
             // substring parameter, unlike say 38;2;..., but really we have no
             // idea what this is.
-            state.style |= (1U << 12U);
+            state->sgr.style |= (1U << 12U);
           } else if (tok_res.val >= 20 && tok_res.val < 30) {
             // Turn off the other styles that map exactly from 1-9 to 21-29
-            state.style &= ~(1U << (tok_res.val - 20));
+            state->sgr.style &= ~(1U << (tok_res.val - 20));
           } else if (tok_res.val >= 30 && tok_res.val < 50) {
             // Colors; much shared logic between color and bg_color, so
             // combining that here
@@ -445,12 +478,14 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
             // tokens
 
             if(col_code == 8) {
-              state = parse_colors(state, foreground ? 3 : 4);
+              parse_colors(state, foreground ? 3 : 4);
             } else {
               // It's possible for col_code = 8 to not actually change color if
               // the parsing fails, so wait until end to set the color
-              if(foreground) state.color = col_code;
-              else state.bg_color = col_code;
+              uint32_t color =
+                col_code < 0 ? 0 : FANSI_CLR(FANSI_CLR_8, col_code);
+              if(foreground) state->sgr.color = color;
+              else state->sgr.bg_color = color;
             }
           } else if(
             (tok_res.val >= 90 && tok_res.val <= 97) ||
@@ -459,45 +494,46 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
             // Does terminal support bright colors? We do not consider it an
             // error if it doesn't.
 
-            if(state.term_cap & 1) {
+            if(state->term_cap & 1) {
               if (tok_res.val < 100) {
-                state.color = tok_res.val;
+                state->sgr.color = FANSI_CLR(FANSI_CLR_BRIGHT, tok_res.val - 90);
               } else {
-                state.bg_color = tok_res.val;
+                state->sgr.bg_color =
+                  FANSI_CLR(FANSI_CLR_BRIGHT, tok_res.val - 100);
             } }
           } else if(tok_res.val == 50) {
             // Turn off 26
-            state.style &= ~(1U << 12U);
+            state->sgr.style &= ~(1U << 12U);
           } else if(tok_res.val > 50 && tok_res.val < 60) {
             // borders
 
             if(tok_res.val < 54) {
-              state.border |= (1U << (unsigned int)(tok_res.val - 50));
+              state->sgr.border |= (1U << (unsigned int)(tok_res.val - 50));
             } else if (tok_res.val == 54) {
-              state.border &= ~(1U << 1);
-              state.border &= ~(1U << 2);
+              state->sgr.border &= ~(1U << 1);
+              state->sgr.border &= ~(1U << 2);
             } else if (tok_res.val == 55) {
-              state.border &= ~(1U << 3);
+              state->sgr.border &= ~(1U << 3);
             } else {
-              state.err_code = 1;  // unknown token
+              state->err_code = 1;  // unknown token
             }
           } else if(tok_res.val >= 60 && tok_res.val < 70) {
             // borders
 
             if(tok_res.val < 65) {
-              state.ideogram |= (1U << (unsigned int)(tok_res.val - 60));
+              state->sgr.ideogram |= (1U << (unsigned int)(tok_res.val - 60));
             } else if (tok_res.val == 65) {
-              state.ideogram = 0;
+              state->sgr.ideogram = 0;
             } else {
-              state.err_code = 1;  // unknown token
+              state->err_code = 1;  // unknown token
             }
           } else {
-            state.err_code = 1;  // unknown token
+            state->err_code = 1;  // unknown token
           }
         }
-        if(state.style > ((1 << (FANSI_STYLE_MAX + 1)) - 1))
+        if(state->sgr.style > ((1 << (FANSI_STYLE_MAX + 1)) - 1))
           // nocov start
-          error(
+          FANSI_error(
             "Internal Error: style greater than FANSI_STYLE_MAX; ",
             "contact maintainer."
           );
@@ -507,76 +543,77 @@ static struct FANSI_state read_esc(struct FANSI_state state) {
         // parse_colors can change the corresponding value in the `state`
         // struct, so better to deal with that directly
 
-        if(state.err_code > err_code) err_code = state.err_code;
-        if(state.last) break;
+        if(state->err_code > err_code) err_code = state->err_code;
+        if(state->last) break;
       } while(1);
       // Need to check that sequence actually is SGR, and if not, we need to
       // restore the state.
 
-      if(!state.sgr) {
+      if(!state->is_sgr) {
         // CSI
-        if(state.ctl & FANSI_CTL_CSI) {
-          state = FANSI_state_copy_style(state, state_prev);
+        if(state->ctl & FANSI_CTL_CSI) {
+          state->sgr = state_prev.sgr;
           esc_recognized = 1;
         } else {
-          state = state_prev;
+          *state = state_prev;
         }
-      } else if (state.ctl & FANSI_CTL_SGR) {
+      } else if (state->ctl & FANSI_CTL_SGR) {
         // SGR and SGR tracking enabled
         esc_recognized = 1;
       } else {
         // SGR, but SGR tracking disabled
-        state = state_prev;
+        *state = state_prev;
       }
     }
     // If the ESC was recognized then record error and advance, otherwise reset
     // the state and advance as if reading an ASCII character.
 
     if(esc_recognized) {
-      if(state.err_code > err_code) err_code = state.err_code;
+      if(state->err_code > err_code) err_code = state->err_code;
 
-      int byte_offset = state.pos_byte - state_prev.pos_byte;
-      state.pos_ansi += byte_offset;
+      int byte_offset = state->pos.byte - state_prev.pos.byte;
+      state->pos.ansi += byte_offset;
     } else {
-      state = state_prev;
-      state = read_ascii(state);
+      *state = state_prev;
+      read_ascii(state);
     }
   }
   if(err_code) {
     // All errors are zero width; there should not be any errors if
     // !esc_recognized.
-    state.err_code = err_code;  // b/c we want the worst err code
-    state.last_char_width = 0;
+    state->err_code = err_code;  // b/c we want the worst err code
+    state->last_char_width = 0;
     if(err_code == 3) {
-      state.err_msg =
+      state->err_msg =
         "a CSI SGR sequence with color codes not supported by terminal";
     } else if(err_code < 4) {
-      state.err_msg = "a CSI SGR sequence with unknown substrings";
+      state->err_msg = "a CSI SGR sequence with unknown substrings";
     } else if (err_code == 4) {
-      state.err_msg = "a non-SGR CSI sequence";
+      state->err_msg = "a non-SGR CSI sequence";
     } else if (err_code == 5) {
-      state.err_msg = "a malformed CSI sequence";
+      state->err_msg = "a malformed CSI sequence";
     } else if (err_code == 6) {
-      state.err_msg = "a non-CSI escape sequence";
+      state->err_msg = "a non-CSI escape sequence";
     } else if (err_code == 7) {
-      state.err_msg = "a malformed escape sequence";
+      state->err_msg = "a malformed escape sequence";
     } else {
       // nocov start
-      error("Internal Error: unknown ESC parse error; contact maintainer.");
+      FANSI_error(
+        "Internal Error: unknown ESC parse error; contact maintainer."
+      );
       // nocov end
     }
   } else {
     // Not 100% sure this is right...
-    state.last_char_width = 1;
-    state.err_msg = "";
+    state->last_char_width = 1;
+    state->err_msg = "";
   }
-  return state;
 }
 /*
  * Read UTF8 character
  */
-static struct FANSI_state read_utf8(struct FANSI_state state) {
-  int byte_size = FANSI_utf8clen(state.string[state.pos_byte]);
+static void read_utf8(struct FANSI_state * state) {
+  int byte_size = FANSI_utf8clen(state->string[state->pos.byte]);
 
   // Make sure string doesn't end before UTF8 char supposedly does
 
@@ -586,37 +623,33 @@ static struct FANSI_state read_utf8(struct FANSI_state state) {
     "use `is.na(nchar(x, allowNA=TRUE))` to find problem strings.";
 
   for(int i = 1; i < byte_size; ++i) {
-    if(!state.string[state.pos_byte + i]) {
+    if(!state->string[state->pos.byte + i]) {
       mb_err = 1;
       byte_size = i;
       break;
   } }
   if(mb_err) {
-    if(state.allowNA) {
-      disp_size = NA_INTEGER;
+    if(state->allowNA) {
+      disp_size = FANSI_NA_INT;
     } else {
       // nocov start
       // shouldn't actually be possible to reach this point since in all use
       // cases we chose to allowNA, except for `nchar_ctl`, which internally
       // uses `nchar` so would never get here anyway
-      error("invalid multiyte string, %s", mb_err_str);
+      FANSI_error("invalid multiyte string, %s", mb_err_str);
       // nocov end
     }
   } else {
-    // In order to compute char display width, we need to create a charsxp
-    // with the sequence in question.  Hopefully not too much overhead since
-    // at least we benefit from the global string hash table
+    // Display width comes from our own table rather than `R_nchar`, which
+    // would require a CHARSXP for every character (see FANSI_utf8_width).
     //
     // Note that we should probably not bother with computing this if display
     // mode is not width as it's probably expensive.
 
-    if(state.use_nchar) {
-      SEXP str_chr =
-        PROTECT(mkCharLenCE(state.string + state.pos_byte, byte_size, CE_UTF8));
-      disp_size = R_nchar(
-        str_chr, Width, state.allowNA, state.keepNA, mb_err_str
-      );
-      UNPROTECT(1);
+    if(state->use_nchar) {
+      disp_size = FANSI_utf8_width(state->string + state->pos.byte, byte_size);
+      if(disp_size == FANSI_NA_INT && !state->allowNA)
+        FANSI_error("invalid multibyte string, %s", mb_err_str);  // nocov
     } else {
       // This is not consistent with what we do with the padding where we use
       // byte_size, but in this case we know we're supposed to be dealing
@@ -625,72 +658,276 @@ static struct FANSI_state read_utf8(struct FANSI_state state) {
       disp_size = 1;
     }
   }
-  // Need to check overflow?  Really only for pos_width?  Maybe that's not
+  // Need to check overflow?  Really only for pos.width?  Maybe that's not
   // even true because you need at least two bytes to encode a double wide
   // character, and there is nothing wider than 2?
 
-  state.pos_byte += byte_size;
-  ++state.pos_ansi;
-  ++state.pos_raw;
-  if(disp_size == NA_INTEGER) {
-    state.err_code = 9;
-    state.err_msg = "a malformed UTF-8 sequence";
-    state.nchar_err = 1;
+  state->pos.byte += byte_size;
+  ++state->pos.ansi;
+  ++state->pos.raw;
+  if(disp_size == FANSI_NA_INT) {
+    state->err_code = 9;
+    state->err_msg = "a malformed UTF-8 sequence";
+    state->nchar_err = 1;
     disp_size = byte_size;
   }
-  state.last_char_width = disp_size;
-  state.pos_width += disp_size;
-  state.pos_width_target += disp_size;
-  state.has_utf8 = 1;
-  return state;
+  state->last_char_width = disp_size;
+  state->pos.width += disp_size;
+  state->pos.width_target += disp_size;
+  state->has_utf8 = 1;
 }
 /*
  * C0 ESC sequences treated as zero width and do not count as characters either
  */
-static struct FANSI_state read_c0(struct FANSI_state state) {
-  int is_nl = state.string[state.pos_byte] == '\n';
+static void read_c0(struct FANSI_state * state) {
+  int is_nl = state->string[state->pos.byte] == '\n';
   if(!is_nl) {
     // question: should we make the comment about tabs as spaces?
-    state.err_msg = "a C0 control character";
-    state.err_code = 8;
+    state->err_msg = "a C0 control character";
+    state->err_code = 8;
   }
-  state = read_ascii(state);
+  read_ascii(state);
   // If C0/NL are being actively processed, treat them as width zero
   if(
-    (is_nl && (state.ctl & FANSI_CTL_NL)) ||
-    (!is_nl && (state.ctl & FANSI_CTL_C0))
+    (is_nl && (state->ctl & FANSI_CTL_NL)) ||
+    (!is_nl && (state->ctl & FANSI_CTL_C0))
   ) {
-    --state.pos_raw;
-    --state.pos_width;
-    --state.pos_width_target;
+    --state->pos.raw;
+    --state->pos.width;
+    --state->pos.width_target;
   }
-  return state;
 }
 /*
  * Read a Character Off and Update State
  *
- * This can probably use some pretty serious optimization...
+ * `state` is updated in place; the read pipeline is called once per character
+ * so we avoid copying the (large) state struct around.  Callers that need to
+ * keep the previous state must copy it themselves.
  */
-struct FANSI_state FANSI_read_next(struct FANSI_state state) {
-  const char chr_val = state.string[state.pos_byte];
-  if(state.err_code) state.err_code = 0; // reset err code after each char
+void FANSI_read_next(struct FANSI_state * state) {
+  const char chr_val = state->string[state->pos.byte];
+  if(state->err_code) state->err_code = 0; // reset err code after each char
 
   // Normal ASCII characters
-  if(chr_val >= 0x20 && chr_val < 0x7F) state = read_ascii(state);
+  if(chr_val >= 0x20 && chr_val < 0x7F) read_ascii(state);
   // UTF8 characters (if chr_val is signed, then > 0x7f will be negative)
-  else if (chr_val < 0 || chr_val > 0x7f) state = read_utf8(state);
+  else if (chr_val < 0 || chr_val > 0x7f) read_utf8(state);
   // ESC sequences
-  else if (chr_val == 0x1B) state = read_esc(state);
+  else if (chr_val == 0x1B) read_esc(state);
   // C0 escapes (e.g. \t, \n, etc)
-  else if(chr_val) state = read_c0(state);
-
-  if(state.warn > 0 && state.err_code) {
-    warning(
-      "Encountered %s, %s%s", state.err_msg,
-      "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
-      "off these warnings."
+  else if(chr_val) read_c0(state);
+
+  if(state->warn > 0 && state->err_code) {
+    if(state->warn != FANSI_WARN_DEFER)
+      FANSI_warning(
+        "Encountered %s, %s%s", state->err_msg,
+        "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
+        "off these warnings."
+      );
+    state->warn = -state->warn; // only warn once
+  }
+}
+/*
+ * Skip to the next byte that could start a control sequence
+ *
+ * That is, the first byte in [x, end) that is a C0 control (less than 0x20,
+ * which includes the NULL terminator) or DEL (0x7F), or `end` if there is none.
+ * Bytes 0x80 and up are UTF-8 and never controls.
+ *
+ * Long strings are examined 16 (SSE2) or 32 (AVX2) bytes at a time on x86-64,
+ * with the AVX2 version selected at load time by `FANSI_init_simd` if the CPU
+ * supports it.  Vector loads never extend past `end` so we cannot fault on a
+ * page boundary after the string.  Install with `PKG_CPPFLAGS=-DFANSI_NO_SIMD`
+ * to use only the scalar version.
+ */
+static const char * skip_plain_scalar(const char * x, const char * end) {
+  while(x < end && (unsigned char)(*x) >= 0x20 && *x != 0x7F) ++x;
+  return x;
+}
+#ifdef FANSI_X86_SIMD
+
+static const char * skip_plain_sse2(const char * x, const char * end) {
+  const __m128i lim = _mm_set1_epi8(0x1F);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  while(end - x >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) x);
+    __m128i hit = _mm_or_si128(
+      _mm_cmpeq_epi8(_mm_min_epu8(v, lim), v), _mm_cmpeq_epi8(v, del)
     );
-    state.warn = -state.warn; // only warn once
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+    if(mask) return x + __builtin_ctz(mask);
+    x += 16;
+  }
+  return skip_plain_scalar(x, end);
+}
+__attribute__((target("avx2")))
+static const char * skip_plain_avx2(const char * x, const char * end) {
+  const __m256i lim = _mm256_set1_epi8(0x1F);
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  while(end - x >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) x);
+    __m256i hit = _mm256_or_si256(
+      _mm256_cmpeq_epi8(_mm256_min_epu8(v, lim), v),
+      _mm256_cmpeq_epi8(v, del)
+    );
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+    if(mask) return x + __builtin_ctz(mask);
+    x += 32;
+  }
+  return skip_plain_sse2(x, end);
+}
+static const char * (*skip_plain)(const char *, const char *) =
+  skip_plain_sse2;
+
+#else
+
+static const char * (*skip_plain)(const char *, const char *) =
+  skip_plain_scalar;
+
+#endif
+
+void FANSI_init_simd() {
+#ifdef FANSI_X86_SIMD
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) skip_plain = skip_plain_avx2;
+#endif
+}
+/*
+ * Compute Location and Size of Next ANSI Sequences
+ *
+ * See FANSI_parse_esc as well, where there is similar logic, although we keep
+ * it separated here for speed since we don't try to interpret the string.
+ *
+ * Length includes the ESC and [, and start point is the ESC.
+ *
+ * Validity here means striclty that all the contained escape sequences were
+ * valid CSI sequences as per the strict definition.
+ *
+ * We report the length of invalid sequnces, but you really can't trust them.
+ * The true length may actually be different depending on your terminal,
+ * (e.g. OSX terminal spits out illegal characters to screen but keeps
+ * processing the sequence).
+ *
+ * @param end pointer to the NULL terminator of the string `x` is part of, used
+ *   to bound the search for the first control character.
+ * @param ctl is a bit flag to line up against VALID.WHAT index values, so
+ *   (ctl & (1 << 0)) is newlines, (ctl & (1 << 1)) is C0, etc, though note
+ *   this does not act
+ */
+
+struct FANSI_csi_pos FANSI_find_esc(
+  const char * x, const char * end, int ctl
+) {
+  /***************************************************\
+  | IMPORTANT: KEEP THIS ALIGNED WITH FANSI_read_esc  |
+  | although now this also deals with c0              |
+  \***************************************************/
+  int valid = 1;
+  int found = 0;
+  int found_ctl = 0;
+  const char * x_track = x;
+  const char * x_found_start = x;
+  const char * x_found_end = x;
+
+  struct FANSI_csi_pos res;
+
+  while(1) {
+    // Until we find something, only bytes that could be part of a control
+    // sequence need to be examined
+
+    if(!found) x_track = skip_plain(x_track, end);
+    if(!*x_track) break;
+
+    const char x_val = *(x_track++);
+    // use found & found_this in conjunction so that we can allow multiple
+    // adjacent elements to be found in one go
+
+    int found_this = 0;
+
+    // If not normal ASCII or UTF8, examine whether we need to found
+    if(!((x_val > 31 && x_val < 127) || x_val < 0 || x_val > 127)) {
+      if(!found) {
+        // Keep resetting strip start point until we find something we want to
+        // mark
+        x_found_start = x_found_end = x_track - 1;
+      }
+      found_this = 0;
+      if(x_val == 27) {
+        if(*x_track == '[') {
+          // This is a CSI sequence, so it has multiple characters that we
+          // need to skip.  The final character is processed outside of here
+          // since it has the same logic for CSI and non CSI sequences
+
+          // skip [
+
+          ++x_track;
+
+          // Skip all the valid parameters tokens
+
+          while(*x_track >= 0x30 && *x_track <= 0x3F) ++x_track;
+
+          // And all the valid intermediates
+
+          int intermediate = 0;
+          while(*x_track >= 0x20 && *x_track <= 0x2F) {
+            if(!intermediate) intermediate = 1;
+            ++x_track;
+          }
+          // Check validity
+
+          int valid_tmp = *x_track >= 0x40 && *x_track <= 0x7E;
+
+          // If not valid, consume all subsequent parameter tokens  as that
+          // seems to be terminal.osx and iterm behavior (though terminal.osx
+          // seems pretty picky about what it considers intermediate or even
+          // parameter characters).
+
+          if(!valid_tmp)
+            while(*x_track >= 0x20 && *x_track <= 0x3F) ++x_track;
+
+          valid = valid && valid_tmp;
+
+          // CSI SGR only found if ends in m and no intermediate
+
+          int sgr = !intermediate && *x_track == 'm';
+          found_ctl |= sgr ? FANSI_CTL_SGR & ctl : FANSI_CTL_CSI & ctl;
+          found_this =
+            (sgr && (ctl & FANSI_CTL_SGR)) ||  // SGR
+            (!sgr && (ctl & FANSI_CTL_CSI));      // CSI
+        } else {
+          // Includes both the C1 set and "controls strings"
+          found_this = ctl & FANSI_CTL_ESC;
+          found_ctl |= ctl & FANSI_CTL_ESC;
+          valid = valid && (*x_track >= 0x40 && *x_track <= 0x7E);
+        }
+        // Advance unless next char is ESC, in which case we want to keep
+        // looping
+
+        if(*x_track && *x_track != 27) x_track++;
+      } else {
+        // x01-x1F, x7F, all the C0 codes
+
+        found_ctl |= (x_val == '\n' ? ctl & FANSI_CTL_NL : ctl & FANSI_CTL_C0);
+        found_this =
+          (x_val == '\n' && (ctl & FANSI_CTL_NL)) ||
+          (x_val != '\n' && (ctl & FANSI_CTL_C0));
+      }
+      if(found_this) {
+        x_found_end = x_track;
+        if(!found) found = 1;
+      }
+    }
+    if(found && !found_this) break;
+  }
+  if(found) {
+    res = (struct FANSI_csi_pos){
+      .start=x_found_start, .len=(x_found_end - x_found_start),
+      .valid=valid, .ctl=found_ctl
+    };
+  } else {
+    res = (struct FANSI_csi_pos){
+      .start=x, .len=0, .valid=valid, ctl=found_ctl
+    };
   }
-  return state;
+  return res;
 }
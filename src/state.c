@@ -82,8 +82,6 @@ struct FANSI_state FANSI_state_init_full(
   }
   return (struct FANSI_state) {
     .string = string,
-    .color = -1,
-    .bg_color = -1,
     .warn = warn_int,
     .term_cap = term_cap_int,
     .allowNA = asLogical(allowNA),
@@ -108,15 +106,13 @@ struct FANSI_state FANSI_state_init(
   UNPROTECT(3);
   return res;
 }
-struct FANSI_state FANSI_reset_width(struct FANSI_state state) {
-  state.pos_width = 0;
-  state.pos_width_target = 0;
-  return state;
+void FANSI_reset_width(struct FANSI_state * state) {
+  state->pos.width = 0;
+  state->pos.width_target = 0;
 }
-struct FANSI_state FANSI_inc_width(struct FANSI_state state, int inc) {
-  state.pos_width += inc;
-  state.pos_width_target += inc;
-  return state;
+void FANSI_inc_width(struct FANSI_state * state, int inc) {
+  state->pos.width += inc;
+  state->pos.width_target += inc;
 }
 /*
  * Reset the position counters
@@ -126,14 +122,13 @@ struct FANSI_state FANSI_inc_width(struct FANSI_state state, int inc) {
  *
  * We are not 100% sure we're resetting everything that needs to be reset.
  */
-struct FANSI_state FANSI_reset_pos(struct FANSI_state state) {
-  state.pos_byte = 0;
-  state.pos_ansi = 0;
-  state.pos_raw = 0;
-  state.pos_width = 0;
-  state.pos_width_target = 0;
-  state.last_char_width = 0;
-  return state;
+void FANSI_reset_pos(struct FANSI_state * state) {
+  state->pos.byte = 0;
+  state->pos.ansi = 0;
+  state->pos.raw = 0;
+  state->pos.width = 0;
+  state->pos.width_target = 0;
+  state->last_char_width = 0;
 }
 /*
  * Compute the state given a character position (raw position)
@@ -165,7 +160,7 @@ struct FANSI_state_pair FANSI_state_at_position(
   int pos, struct FANSI_state_pair state_pair, int type, int lag, int end
 ) {
   struct FANSI_state state = state_pair.cur;
-  int pos_init = type ? state.pos_width : state.pos_raw;
+  int pos_init = type ? state.pos.width : state.pos.raw;
   if(pos < pos_init)
     // nocov start
     error(
@@ -176,39 +171,62 @@ struct FANSI_state_pair FANSI_state_at_position(
     // nocov end
   int cond = 0;
 
-  // Need to reset pos_width_target since it could be distorted by a previous
+  // Need to reset pos.width_target since it could be distorted by a previous
   // middle of wide char event
 
-  state.pos_width_target = state.pos_width;
+  state.pos.width_target = state.pos.width;
 
-  struct FANSI_state state_res, state_prev, state_prev_buff;
+  // `state_res` is the state prior to the last read, and becomes `prev` in the
+  // original sense unless the last read was zero width (see below).
 
-  state_prev = state_prev_buff = state_pair.prev;
+  struct FANSI_state state_res, state_prev_buff;
+
+  state_prev_buff = state_pair.prev;
   state_res = state;
 
   while(1) {
-    state_prev = state_res = state;
+    // Printable ASCII short of the target can be read in bulk.  We leave the
+    // last character of the run, and the one that reaches the target, to the
+    // regular read below as those are the ones that can end the loop, so
+    // `state_prev_buff` ends up as it would have had we read the characters one
+    // at a time.
+
+    if(type == 0 || type == 1) {
+      int ahead = pos - (type ? state.pos.width : state.pos.raw) - 1;
+      const char * run = state.string + state.pos.byte;
+      int run_len = 0;
+      if(*run >= 0x20 && *run < 0x7F) {
+        while(
+          run_len < ahead &&
+          run[run_len + 1] >= 0x20 && run[run_len + 1] < 0x7F
+        )
+          ++run_len;
+      }
+      if(run_len && FANSI_read_ascii(&state, &state_prev_buff, run_len, 1))
+        state.last = 0;
+    }
+    state_res = state;
     state.err_code = state.last = 0;
 
     // Handle UTF-8, we need to record the byte size of the sequence as well as
     // the corresponding display width.
 
-    if(state.pos_byte == INT_MAX)
+    if(state.pos.byte == INT_MAX)
       // nocov start
       // ... a bit tricky here, because we read ahead a few bytes in some
-      // circumstances, but not all, so the furthest pos_byte should be allowed
+      // circumstances, but not all, so the furthest pos.byte should be allowed
       // to get actually varies
       error("Internal Error: counter overflow while reading string.");
       // nocov end
 
-    state = FANSI_read_next(state);
+    FANSI_read_next(&state);
 
     // cond is just how many units we have left until our requested position.
     // we can overshoot and it can be negative
 
     switch(type) {
-      case 0: cond = pos - state.pos_raw; break;
-      case 1: cond = pos - state.pos_width; break;
+      case 0: cond = pos - state.pos.raw; break;
+      case 1: cond = pos - state.pos.width; break;
       default:
         // nocov start
         error("Internal Error: Illegal offset type; contact maintainer.");
@@ -218,24 +236,22 @@ struct FANSI_state_pair FANSI_state_at_position(
     Rprintf(
       "cnd %2d x %2d lag %d end %d w (%2d %2d) ansi (%2d %2d) bt (%2d %2d)\n",
       cond, pos, lag, end,
-      state.pos_width, state_prev.pos_width,
-      state.pos_ansi, state_prev.pos_ansi,
-      state.pos_byte, state_prev.pos_byte
+      state.pos.width, state_res.pos.width,
+      state.pos.ansi, state_res.pos.ansi,
+      state.pos.byte, state_res.pos.byte
     );
     */
-    // If zero width advance, we want to update prev state to be the newest
-    // state
-
-    if(state.pos_width == state_prev.pos_width) state_prev = state;
-
     // We still have stuff to process, though keep in mind we can be at end of
     // string with cond > 0 if we ask for position past end
 
     if(cond >= 0) {
-      if(state.string[state.pos_byte]) {
+      if(state.string[state.pos.byte]) {
         // some ambiguity as to whether the next `state_prev` will be valid, so
-        // we store the current one just in case
-        state_prev_buff = state_prev;
+        // we store the current one just in case.  If zero width advance, we
+        // want `prev` to be the newest state.
+
+        if(state.pos.width == state_res.pos.width) state_prev_buff = state;
+        else state_prev_buff = state_res;
         continue;
       }
       // state_res = state_prev;
@@ -260,7 +276,7 @@ struct FANSI_state_pair FANSI_state_at_position(
         }
       }
       // This is the width we hoped to get originally
-      state_res.pos_width_target = pos;
+      state_res.pos.width_target = pos;
     } else if(cond < -1) {
       // nocov start
       error(
@@ -281,41 +297,42 @@ struct FANSI_state_pair FANSI_state_at_position(
 
   if(end) {
     struct FANSI_state state_next, state_next_prev, state_next_prev_prev;
-    state_next_prev_prev = state_res;
-    state_next_prev = FANSI_read_next(state_next_prev_prev);
-    state_next = FANSI_read_next(state_next_prev);
+    state_next_prev_prev = state_next_prev = state_res;
+    FANSI_read_next(&state_next_prev);
+    state_next = state_next_prev;
+    FANSI_read_next(&state_next);
 
     /*
     Rprintf(
       "npp %d %d %d np %d %d %d n %d %d %d end %d\n",
 
-      state_next_prev_prev.pos_byte,
-      state_next_prev_prev.pos_width,
-      state_next_prev_prev.pos_ansi,
+      state_next_prev_prev.pos.byte,
+      state_next_prev_prev.pos.width,
+      state_next_prev_prev.pos.ansi,
 
-      state_next_prev.pos_byte,
-      state_next_prev.pos_width,
-      state_next_prev.pos_ansi,
+      state_next_prev.pos.byte,
+      state_next_prev.pos.width,
+      state_next_prev.pos.ansi,
 
-      state_next.pos_byte,
-      state_next.pos_width,
-      state_next.pos_ansi,
+      state_next.pos.byte,
+      state_next.pos.width,
+      state_next.pos.ansi,
 
-      state_next.string[state_next.pos_byte] == 0
+      state_next.string[state_next.pos.byte] == 0
     );
     */
 
     while(!state_next.last_char_width) {
       /*
       Rprintf(
-        "next: width %d ansi %d last %d\n", state_next.pos_width,
-        state_next.pos_ansi, state_next.last_char_width
+        "next: width %d ansi %d last %d\n", state_next.pos.width,
+        state_next.pos.ansi, state_next.last_char_width
       );
       */
       state_next_prev_prev = state_next_prev;
       state_next_prev = state_next;
-      state_next = FANSI_read_next(state_next);
-      if(!state_next.string[state_next.pos_byte]) break;
+      FANSI_read_next(&state_next);
+      if(!state_next.string[state_next.pos.byte]) break;
     }
     state_res = state_next_prev_prev;
   }
@@ -324,326 +341,24 @@ struct FANSI_state_pair FANSI_state_at_position(
   return (struct FANSI_state_pair){.cur=state_res, .prev=state_prev_buff};
 }
 /*
- * We always include the size of the delimiter; could be a problem that this
- * isn't the actual size, but rather the maximum size (i.e. we always assume
- * three bytes even if the numbers don't get into three digits).
- */
-int FANSI_color_size(int color, int * color_extra) {
-  int size = 0;
-  if(color == 8 && color_extra[0] == 2) {
-    size = 3 + 2 +
-      FANSI_digits_in_int(color_extra[1]) + 1 +
-      FANSI_digits_in_int(color_extra[2]) + 1 +
-      FANSI_digits_in_int(color_extra[3]) + 1;
-  } else if (color == 8 && color_extra[0] == 5) {
-    size = 3 + 2 +
-      FANSI_digits_in_int(color_extra[1]) + 1;
-  } else if (color == 8) {
-    error("Internal Error: unexpected compound color format");   // nocov
-  } else if (color >= 0 && color < 10) {
-    size = 3;
-  } else if (color >= 90 && color <= 97) {
-    size = 3;
-  } else if (color >= 100 && color <= 107) {
-    size = 4;
-  } else if (color > 0) {
-    error("Internal Error: unexpected color format"); // nocov
-  }
-  return size;
-}
-/*
- * Computes how many bytes we need to write out a state
- *
- * No overflow worries here b/c ints are 32bit+
- *
- * Includes the ESC[m size, but not the NULL terminator, so if you are writing
- * to a string that has nothing else in it remember to allocate an extra byte
- * for the NULL terminator.
- */
-int FANSI_state_size(struct FANSI_state state) {
-  int size = 0;
-  if(FANSI_state_has_style(state)) {
-    int color_size = FANSI_color_size(state.color, state.color_extra);
-    int bg_color_size = FANSI_color_size(state.bg_color, state.bg_color_extra);
-
-    // styles are stored as bits, styles less than 10 correspond to 0-9, the
-    // others are random ones but will need one more byte, hence the
-    // `(2 + (i > 9))`
-
-    int style_size = 0;
-    if(state.style) {
-      for(int i = 1; i <= FANSI_STYLE_MAX; ++i){
-        style_size +=
-          ((state.style & (1 << i)) > 0) *
-          (2 + (i > 9));
-    } }
-    // Some question of whether we are adding a slowdown to check for rarely use
-    // ESC sequences such as these...
-
-    // Border
-
-    int border_size = 0;
-    if(state.border) {
-      for(int i = 1; i < 4; ++i){
-        border_size += ((state.border & (1 << i)) > 0) * 3;
-      }
-    }
-    // Ideogram
-
-    int ideogram_size = 0;
-    if(state.ideogram) {
-      for(int i = 0; i < 5; ++i){
-        ideogram_size += ((state.ideogram & (1 << i)) > 0) * 3;
-      }
-    }
-    // font
-
-    int font_size = 0;
-    if(state.font) font_size = 3;
-
-    size += color_size + bg_color_size + style_size +
-      border_size + ideogram_size + font_size + 2; // +2 for ESC[
-  }
-  return size;
-}
-/*
- * Write extra color info to string
- *
- * Modifies string by reference.  This assumes
- * that the 3 or 4 has been written already and that we're not in a -1 color
- * state that shouldn't have color.
- *
- * String should be a pointer to the location we want to start writing, so
- * should already be offset.  The return value is the offset from the original
- * position
- */
-unsigned int FANSI_color_write(
-  char * string, int color, int * color_extra, int mode
-) {
-  if(mode != 3 && mode != 4)
-    error("Internal Error: color mode must be 3 or 4");  // nocov
-
-  unsigned int str_off = 0;
-  if(color >= 0 && color < 10) {
-    string[str_off++] = mode == 3 ? '3' : '4';
-
-    if(color != 8) {
-      string[str_off++] = '0' + color;
-      string[str_off++] = ';';
-    } else {
-      string[str_off++] = '8';
-      string[str_off++] = ';';
-
-      int write_chrs = -1;
-      if(color_extra[0] == 2) {
-        write_chrs = sprintf(
-          string + str_off,
-          "2;%d;%d;%d;", color_extra[1], color_extra[2], color_extra[3]
-        );
-      } else if (color_extra[0] == 5) {
-        write_chrs = sprintf(string + str_off, "5;%d;", color_extra[1]);
-      } else error("Internal Error: unexpected color code.");  // nocov
-
-      if(write_chrs < 0)
-        error("Internal Error: failed writing color code.");  // nocov
-      str_off += write_chrs;
-    }
-  } else if(color >= 100 && color <= 107) {
-    // bright colors, we don't actually need to worry about bg vs fg since the
-    // actual color values are different
-
-    string[str_off++] = '1';
-    string[str_off++] = '0';
-    string[str_off++] = '0' + color - 100;
-    string[str_off++] = ';';
-  } else if(color >= 90 && color <= 97) {
-    string[str_off++] = '9';
-    string[str_off++] = '0' + color - 90;
-    string[str_off++] = ';';
-  }
-  return str_off;
-}
-/*
- * We split this part out because in some cases we want to modify pre-existing
- * buffers
- *
- * Modifies the buffer by reference.
- *
- * DOES NOT ADD NULL TERMINATOR.
- *
- * return how many bytes were written
- */
-int FANSI_csi_write(char * buff, struct FANSI_state state, int buff_len) {
-  /****************************************************\
-  | IMPORTANT: KEEP THIS ALIGNED WITH state_as_html    |
-  | although right now ignoring rare escapes in html   |
-  \****************************************************/
-
-  int str_pos = 0;
-
-  if(FANSI_state_has_style(state)) {
-    buff[str_pos++] = 27;    // ESC
-    buff[str_pos++] = '[';
-    // styles
-
-    for(int i = 1; i < 10; i++) {
-      if((1 << i) & state.style) {
-        buff[str_pos++] = '0' + i;
-        buff[str_pos++] = ';';
-    } }
-    // styles outside 0-9
-
-    if(state.style & (1 << 10)) {
-      // fraktur
-      buff[str_pos++] = '2';
-      buff[str_pos++] = '0';
-      buff[str_pos++] = ';';
-    }
-    if(state.style & (1 << 11)) {
-      // double underline
-      buff[str_pos++] = '2';
-      buff[str_pos++] = '1';
-      buff[str_pos++] = ';';
-    }
-    if(state.style & (1 << 12)) {
-      // prop spacing
-      buff[str_pos++] = '2';
-      buff[str_pos++] = '6';
-      buff[str_pos++] = ';';
-    }
-    // colors
-
-    str_pos += FANSI_color_write(
-      &(buff[str_pos]), state.color, state.color_extra, 3
-    );
-    str_pos += FANSI_color_write(
-      &(buff[str_pos]), state.bg_color, state.bg_color_extra, 4
-    );
-    // Borders
-
-    if(state.border) {
-      for(int i = 1; i < 4; ++i){
-        if((1 << i) & state.border) {
-          buff[str_pos++] = '5';
-          buff[str_pos++] = '0' + i;
-          buff[str_pos++] = ';';
-    } } }
-    // Ideogram
-
-    if(state.ideogram) {
-      for(int i = 0; i < 5; ++i){
-        if((1 << i) & state.ideogram) {
-          buff[str_pos++] = '6';
-          buff[str_pos++] = '0' + i;
-          buff[str_pos++] = ';';
-    } } }
-    // font
-
-    if(state.font) {
-      buff[str_pos++] = '1';
-      buff[str_pos++] = '0' + (state.font % 10);
-      buff[str_pos++] = ';';
-    }
-    // Finalize
-
-    if(str_pos != buff_len)
-      // nocov start
-      // note this error is really too late, as we could have written past
-      // allocation in the steps above
-      error(
-        "Internal Error: tag mem allocation mismatch (%u, %u)",
-        str_pos, buff_len
-      );
-      // nocov end
-    buff[str_pos - 1] = 'm';
-  }
-  return str_pos;
-}
-/*
- * Generate the ANSI tag corresponding to the state and write it out as a NULL
+ * Generate the ANSI tag corresponding to the style and write it out as a NULL
  * terminated string.
  */
-char * FANSI_state_as_chr(struct FANSI_state state) {
+char * FANSI_style_as_chr(struct FANSI_style sgr) {
   // First pass computes total size of tag; we need to account for the
   // separator as well
 
-  int tag_len = FANSI_state_size(state);
+  int tag_len = FANSI_style_size(sgr);
 
   // Now allocate and generate tag
 
   char * tag_tmp = R_alloc(tag_len + 1, sizeof(char));
-  int tag_len_written = FANSI_csi_write(tag_tmp, state, tag_len);
+  int tag_len_written = FANSI_csi_write(tag_tmp, sgr, tag_len);
   if(tag_len_written > tag_len)
     error("Internal Error: CSI written larger than expected."); // nocov
   tag_tmp[tag_len_written] = 0;
   return tag_tmp;
 }
-/*
- * Determine whether two state structs have same style
- *
- * This only compares the style pieces (i.e. not the position pieces)
- *
- * Returns 1 if the are different, 0 if they are equal.
- *
- * _basic is used just for the 1-9 SGR codes plus colors.
- */
-int FANSI_state_comp_basic(
-  struct FANSI_state target, struct FANSI_state current
-) {
-  // 1023 is '11 1111 1111' in binary, so this will grab the last ten bits
-  // of the styles which are the 1-9 styles
-  return !(
-    (target.style & 1023) == (current.style & 1023) &&
-    target.color == current.color &&
-    target.bg_color == current.bg_color &&
-    target.color_extra[0] == current.color_extra[0] &&
-    target.bg_color_extra[0] == current.bg_color_extra[0] &&
-    target.color_extra[1] == current.color_extra[1] &&
-    target.bg_color_extra[1] == current.bg_color_extra[1] &&
-    target.color_extra[2] == current.color_extra[2] &&
-    target.bg_color_extra[2] == current.bg_color_extra[2] &&
-    target.color_extra[3] == current.color_extra[3] &&
-    target.bg_color_extra[3] == current.bg_color_extra[3]
-  );
-}
-int FANSI_state_comp(struct FANSI_state target, struct FANSI_state current) {
-  return !(
-    !FANSI_state_comp_basic(target, current) &&
-    target.style == current.style &&
-    target.border == current.border &&
-    target.font == current.font &&
-    target.ideogram == current.ideogram
-  );
-}
-int FANSI_state_has_style(struct FANSI_state state) {
-  return
-    state.style || state.color >= 0 || state.bg_color >= 0 ||
-    state.font || state.border || state.ideogram;
-}
-int FANSI_state_has_style_basic(struct FANSI_state state) {
-  return state.style || state.color >= 0 || state.bg_color >= 0;
-}
-/*
- * Copy the style members from current to target
- */
-struct FANSI_state FANSI_state_copy_style(
-  struct FANSI_state target, struct FANSI_state current
-) {
-  target.style = current.style;
-  target.border = current.border;
-  target.font = current.font;
-  target.ideogram = current.ideogram;
-
-  target.color = current.color;
-  for(int i = 0; i < 4; ++i) {
-    target.color_extra[i] = current.color_extra[i];
-  }
-  target.bg_color = current.bg_color;
-  for(int i = 0; i < 4; ++i) {
-    target.bg_color_extra[i] = current.bg_color_extra[i];
-  }
-  return target;
-}
 /*
  * R interface for FANSI_state_at_position
  * @param string we're interested in state of
@@ -765,15 +480,15 @@ SEXP FANSI_state_at_pos_ext(
       // `substr` probably can't subset the INTMAX character due to the 1
       // indexing...
 
-      REAL(res_mx)[i * res_cols + 0] = state.pos_byte + 1;
-      REAL(res_mx)[i * res_cols + 1] = state.pos_raw + 1;
-      REAL(res_mx)[i * res_cols + 2] = state.pos_ansi + 1;
-      REAL(res_mx)[i * res_cols + 3] = state.pos_width_target + 1;
+      REAL(res_mx)[i * res_cols + 0] = state.pos.byte + 1;
+      REAL(res_mx)[i * res_cols + 1] = state.pos.raw + 1;
+      REAL(res_mx)[i * res_cols + 2] = state.pos.ansi + 1;
+      REAL(res_mx)[i * res_cols + 3] = state.pos.width_target + 1;
 
       // Record color tag if state changed
 
-      if(FANSI_state_comp(state, state_prev)) {
-        res_chr = PROTECT(mkChar(FANSI_state_as_chr(state)));
+      if(FANSI_style_comp(state.sgr, state_prev.sgr)) {
+        res_chr = PROTECT(mkChar(FANSI_style_as_chr(state.sgr)));
       } else {
         res_chr = PROTECT(res_chr_prev);
       }
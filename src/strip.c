@@ -17,21 +17,84 @@
  */
 
 #include "fansi.h"
+
 /*
- * Strips ANSI tags from input
- *
- * Assumes input is NULL terminated.
+ * Strip one string
  *
- * Since we do not use FANSI_read_next, we don't care about conversions to
- * UTF8.
+ * Does not use the R API so it is safe to call from worker threads.
  *
- * @param warn normally TRUE or FALSE, but internally we allow it to be an
- *   integer so that we can use a special mode where if == 2 then we return the
- *   fact that there was a warning as an attached attributed, as opposed to
- *   actually throwing the warning
+ * @param end pointer to the NULL terminator of `chr`.
+ * @param buff where to write the stripped string, must be at least as large as
+ *   `chr` including the NULL terminator.  If NULL we only compute the size of
+ *   the stripped string.
+ * @param invalid set to 1 if an invalid or possibly incorrectly handled
+ *   sequence is found, otherwise left untouched.
+ * @return the number of bytes in the stripped string (excluding the NULL), or
+ *   -1 if there was nothing to strip, in which case `buff` is not written to.
  */
-
-SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
+int FANSI_strip_chr(
+  const char * chr, const char * end, int ctl, char * buff, int * invalid
+) {
+  const char * chr_track = chr;
+  char * buff_track = buff;
+  int has_ansi = 0;
+  int size = 0;
+
+  while(1) {
+    struct FANSI_csi_pos csi = FANSI_find_esc(chr_track, end, ctl);
+    // Currently we can't know for sure if a ESC seq that isn't a CSI is only
+    // two long so we should warn if we hit one, or otherwise and invalid seq
+
+    if(!csi.valid || ((csi.ctl & FANSI_CTL_ESC) & ctl)) *invalid = 1;
+
+    if(csi.len) {
+      // Can't overflow as sizes are bounded by the length of `chr`
+      has_ansi = 1;
+      size += csi.start - chr_track;
+      if(buff) {
+        memcpy(buff_track, chr_track, csi.start - chr_track);
+        buff_track += csi.start - chr_track;
+      }
+      chr_track = csi.start + csi.len;
+    } else break;
+  }
+  if(!has_ansi) return -1;
+
+  // Copy final chunk if it exists because above we only memcpy when we
+  // encounter the tag
+
+  if(*chr_track && end > chr_track) {
+    size += end - chr_track;
+    if(buff) {
+      memcpy(buff_track, chr_track, end - chr_track);
+      buff_track += end - chr_track;
+  } }
+  if(buff) *buff_track = '\0';
+  return size;
+}
+/*
+ * Issue the stripping warning, or record it as an attribute
+ */
+void FANSI_strip_warn(SEXP res, int warn_int, R_xlen_t invalid_idx) {
+  switch(warn_int) {
+    case 1: {
+      warning(
+        "Encountered %s index [%.0f], %s%s",
+        "invalid or possibly incorreclty handled ESC sequence at ",
+        (double) invalid_idx,
+        "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
+        "off these warnings."
+      );
+      break;
+    }
+    case 2: {
+      SEXP attrib_val = PROTECT(ScalarLogical(1));
+      setAttrib(res, FANSI_warn_sym, attrib_val);
+      UNPROTECT(1);
+      break;
+  } }
+}
+static void strip_check_args(SEXP x, SEXP ctl, SEXP warn) {
   if(TYPEOF(x) != STRSXP)
     error("Argument `x` should be a character vector.");  // nocov
   if(TYPEOF(ctl) != INTSXP)
@@ -45,6 +108,24 @@ SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
   int warn_int = asInteger(warn);
   if(warn_int < 0 || warn_int > 2)
     error("Argument `warn` must be between 0 and 2 if an integer.");  // nocov
+}
+/*
+ * Strips ANSI tags from input
+ *
+ * Assumes input is NULL terminated.
+ *
+ * Since we do not use FANSI_read_next, we don't care about conversions to
+ * UTF8.
+ *
+ * @param warn normally TRUE or FALSE, but internally we allow it to be an
+ *   integer so that we can use a special mode where if == 2 then we return the
+ *   fact that there was a warning as an attached attributed, as opposed to
+ *   actually throwing the warning
+ */
+
+SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
+  strip_check_args(x, ctl, warn);
+  int warn_int = asInteger(warn);
 
   // Compress `ctl` into a single integer using bit flags
 
@@ -59,8 +140,6 @@ SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
   int any_ansi = 0;
   R_len_t mem_req = 0;          // how much memory we need for each ansi
 
-  struct FANSI_csi_pos csi;
-
   // Compute longest char element, we'll assume this is the required size of our
   // string buffer.  This is potentially wastful if there is one very large
   // CSI-less string and all the CSI strings are short.  The alternative would
@@ -75,8 +154,8 @@ SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
   // Now strip
 
   int invalid_ansi = 0;
-  int invalid_idx = 0;
-  char * chr_buff;
+  R_xlen_t invalid_idx = 0;
+  char * chr_buff = NULL;
 
   for(i = 0; i < len; ++i) {
     FANSI_interrupt(i);
@@ -84,125 +163,168 @@ SEXP FANSI_strip(SEXP x, SEXP ctl, SEXP warn) {
     if(x_chr == NA_STRING) continue;
     FANSI_check_enc(x_chr, i);
 
-    int has_ansi = 0;
     const char * chr = CHAR(x_chr);
-    const char * chr_track = chr;
-    char * res_track = NULL, * res_start = NULL;
+    const char * chr_end = chr + LENGTH(x_chr);
+    int invalid = 0;
 
-    // We re-use the allocated buffer for every string in the character
-    // vector, which is why we re-assign to chr_buff here.  chr_buff will be
-    // allocated in the loop below the first time it is needed, but we need to
-    // re-assign re_start / res_track .
+    // The buffer is allocated the first time we find something to strip, so
+    // until then we only check whether there is anything to strip.
 
-    res_start = res_track = chr_buff;
+    int size = FANSI_strip_chr(chr, chr_end, ctl_int, chr_buff, &invalid);
+    if(invalid && !invalid_ansi) {
+      invalid_ansi = 1;
+      invalid_idx = i + 1;
+    }
+    if(size >= 0) {
+      if(!any_ansi) {
+        any_ansi = 1;
 
-    while(1) {
-      csi = FANSI_find_esc(chr_track, ctl_int);
-      // Currently we can't know for sure if a ESC seq that isn't a CSI is only
-      // two long so we should warn if we hit one, or otherwise and invalid seq
-      if(
-        !invalid_ansi && (
-          !csi.valid ||
-          ((csi.ctl & FANSI_CTL_ESC) & ctl_int)
-        )
-      ) {
-        invalid_ansi = 1;
-        invalid_idx = i + 1;
-      }
-      if(csi.len) {
-        has_ansi = 1;
-        if(csi.start - chr > FANSI_int_max - csi.len)
+        // We need to allocate a result vector since we'll be stripping ANSI
+        // CSI, and also the buffer we'll use to re-write the CSI less strings
+
+        REPROTECT(res_fin = duplicate(x), ipx);
+
+        // Note the is guaranteed to be an over-allocation
+
+        if(mem_req == R_LEN_T_MAX)
           // nocov start
           error(
             "%s%s",
-            "Internal Error: string longer than INT_MAX encountered, should ",
-            "not be possible."
+            "Internal error, string should be shorter than R_LEN_T_MAX, ",
+            "contact maintainer."
           );
           // nocov end
 
-        // As soon as we encounter ansi in any of the character vector elements,
-        // allocate vector to track what has ansi
+        // The character buffer is large enough for the largest element in the
+        // vector, and is re-used for every element in the vector.
 
-        if(!any_ansi) {
-          any_ansi = 1;
-
-          // We need to allocate a result vector since we'll be stripping ANSI
-          // CSI, and also the buffer we'll use to re-write the CSI less strings
-
-          REPROTECT(res_fin = duplicate(x), ipx);
-
-          // Note the is guaranteed to be an over-allocation
+        chr_buff = (char *) R_alloc(mem_req + 1, sizeof(char));
+        FANSI_strip_chr(chr, chr_end, ctl_int, chr_buff, &invalid);
+      }
+      SEXP chr_sexp = PROTECT(mkCharLenCE(chr_buff, size, getCharCE(x_chr)));
+      SET_STRING_ELT(res_fin, i, chr_sexp);
+      UNPROTECT(1);
+    }
+  }
+  if(invalid_ansi) FANSI_strip_warn(res_fin, warn_int, invalid_idx);
+  UNPROTECT(1);
+  return res_fin;
+}
+/*
+ * Multi-threaded version of `FANSI_strip`
+ *
+ * Only the scanning and copying runs in parallel as the R API cannot be used
+ * from worker threads, so we proceed in phases:
+ *
+ * 1. Serially collect the CHARSXP data pointers.
+ * 2. In parallel compute the size of each stripped element.
+ * 3. Serially lay out the stripped elements in a single exactly sized arena.
+ * 4. In parallel write the stripped elements to their slots in the arena.
+ * 5. Serially create the CHARSXPs.
+ *
+ * We parse twice to avoid allocating memory in the worker threads, but the
+ * second parse only happens for elements that actually have something to
+ * strip.
+ *
+ * Falls back to `FANSI_strip` if the package was built without OpenMP, or if
+ * there is only one thread.
+ *
+ * @param threads scalar integer number of threads to use.
+ */
 
-          if(mem_req == R_LEN_T_MAX)
-            // nocov start
-            error(
-              "%s%s",
-              "Internal error, string should be shorter than R_LEN_T_MAX, ",
-              "contact maintainer."
-            );
-            // nocov end
+SEXP FANSI_strip_ext(SEXP x, SEXP ctl, SEXP warn, SEXP threads) {
+  if(TYPEOF(threads) != INTSXP || XLENGTH(threads) != 1)
+    error("Internal Error: `threads` should be scalar integer.");  // nocov
+  int threads_int = asInteger(threads);
+  R_xlen_t len = xlength(x);
 
-          // The character buffer is large enough for the largest element in the
-          // vector, and is re-used for every element in the vector.
+#ifndef _OPENMP
+  threads_int = 1;
+#endif
+  if(threads_int < 2 || len < 2) return FANSI_strip(x, ctl, warn);
 
-          chr_buff = (char *) R_alloc(mem_req + 1, sizeof(char));
-          res_start = res_track = chr_buff;
-        }
-        // Is memcpy going to cause problems again by reading past end of
-        // block?  Didn't in first valgrind check.
+  strip_check_args(x, ctl, warn);
+  int warn_int = asInteger(warn);
+  int ctl_int = FANSI_ctl_as_int(ctl);
 
-        memcpy(res_track, chr_track, csi.start - chr_track);
-        res_track += csi.start - chr_track;
-        chr_track = csi.start + csi.len;
-      } else break;
-    }
-    // Update string
+  const char ** chrs = (const char **) R_alloc(len, sizeof(const char *));
+  int * lens = (int *) R_alloc(len, sizeof(int));
+  int * sizes = (int *) R_alloc(len, sizeof(int));
+  char * invalid = (char *) R_alloc(len, sizeof(char));
 
-    if(has_ansi) {
-      // Copy final chunk if it exists because above we only memcpy when we
-      // encounter the tag
+  for(R_xlen_t i = 0; i < len; ++i) {
+    FANSI_interrupt(i);
+    SEXP x_chr = STRING_ELT(x, i);
+    if(x_chr == NA_STRING) {
+      chrs[i] = NULL;
+      lens[i] = 0;
+    } else {
+      FANSI_check_enc(x_chr, i);
+      chrs[i] = CHAR(x_chr);
+      lens[i] = LENGTH(x_chr);
+  } }
+
+  R_xlen_t i;
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads_int) schedule(dynamic, 256)
+#endif
+  for(i = 0; i < len; ++i) {
+    int invalid_i = 0;
+    sizes[i] = chrs[i] ?
+      FANSI_strip_chr(
+        chrs[i], chrs[i] + lens[i], ctl_int, NULL, &invalid_i
+      ) : -1;
+    invalid[i] = (char) invalid_i;
+  }
+  // Find the first invalid element and size the arena
 
-      if(*chr_track) {
-        const char * chr_end = chr + LENGTH(x_chr);
-        if(!chr_end) {
-          // nocov start
-          error(
-            "%s%s",
-            "Internal Error: failed to find str end, ",
-            "contact maintainer."
-          );
-          // nocov end
-        } else if(chr_end > chr_track) {
-          memcpy(res_track, chr_track, chr_end - chr_track);
-          res_track += chr_end - chr_track;
-      } }
-      *res_track = '\0';
-      SEXP chr_sexp = PROTECT(
-        mkCharLenCE(
-          res_start, res_track - res_start, getCharCE(x_chr)
-      ) );
-      SET_STRING_ELT(res_fin, i, chr_sexp);
-      UNPROTECT(1);
+  size_t arena_size = 0;
+  R_xlen_t invalid_idx = 0;
+  int any_ansi = 0;
+  for(i = 0; i < len; ++i) {
+    if(invalid[i] && !invalid_idx) invalid_idx = i + 1;
+    if(sizes[i] >= 0) {
+      any_ansi = 1;
+      arena_size += (size_t) sizes[i] + 1;
+  } }
+  size_t * offs = NULL;
+  char * arena = NULL;
+
+  if(any_ansi) {
+    offs = (size_t *) R_alloc(len, sizeof(size_t));
+    arena = R_alloc(arena_size, sizeof(char));
+    size_t off = 0;
+    for(i = 0; i < len; ++i) {
+      offs[i] = off;
+      if(sizes[i] >= 0) off += (size_t) sizes[i] + 1;
     }
-  }
-  if(invalid_ansi) {
-    switch(warn_int) {
-      case 1: {
-        warning(
-          "Encountered %s index [%.0f], %s%s",
-          "invalid or possibly incorreclty handled ESC sequence at ",
-          (double) invalid_idx,
-          "see `?unhandled_ctl`; you can use `warn=FALSE` to turn ",
-          "off these warnings."
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(threads_int) schedule(dynamic, 256)
+#endif
+    for(i = 0; i < len; ++i) {
+      if(sizes[i] >= 0) {
+        int invalid_i = 0;
+        FANSI_strip_chr(
+          chrs[i], chrs[i] + lens[i], ctl_int, arena + offs[i], &invalid_i
         );
-        break;
-      }
-      case 2: {
-        SEXP attrib_val = PROTECT(ScalarLogical(1));
-        setAttrib(res_fin, FANSI_warn_sym, attrib_val);
+  } } }
+  SEXP res_fin = x;
+  PROTECT_INDEX ipx;
+  PROTECT_WITH_INDEX(res_fin, &ipx);
+
+  if(any_ansi) {
+    REPROTECT(res_fin = duplicate(x), ipx);
+    for(i = 0; i < len; ++i) {
+      FANSI_interrupt(i);
+      if(sizes[i] >= 0) {
+        SEXP chr_sexp = PROTECT(
+          mkCharLenCE(
+            arena + offs[i], sizes[i], getCharCE(STRING_ELT(x, i))
+        ) );
+        SET_STRING_ELT(res_fin, i, chr_sexp);
         UNPROTECT(1);
-        break;
   } } }
+  if(invalid_idx) FANSI_strip_warn(res_fin, warn_int, invalid_idx);
   UNPROTECT(1);
   return res_fin;
 }
@@ -17,136 +17,208 @@
  */
 
 #include "fansi.h"
-// nocov start
-// this is a temporarily un-used implementation, but we may re-use it later
-
-SEXP FANSI_strsplit(SEXP x, SEXP warn, SEXP term_cap) {
-  error("This code is disabled current");
-  warning("Handle UTF8");
-  // UTF8 is a little tricky here, we're now using read_next, but we don't
-  // really need it, so we could maybe have a version without read next that
-  // doesn't need to translate to UTF8.
 
+/*
+ * Growable integer vector of split positions
+ */
+struct split_pos {int * start; int * stop; R_xlen_t len, size;};
+
+static void split_add(struct split_pos * pos, int start, int stop) {
+  if(pos->len >= pos->size) {
+    if(pos->size > R_XLEN_T_MAX / 2)
+      error("Internal Error: too many split pieces.");  // nocov
+    R_xlen_t size_new = pos->size ? pos->size * 2 : 256;
+    int * start_new = (int *) R_alloc(size_new, sizeof(int));
+    int * stop_new = (int *) R_alloc(size_new, sizeof(int));
+    if(pos->len) {
+      memcpy(start_new, pos->start, pos->len * sizeof(int));
+      memcpy(stop_new, pos->stop, pos->len * sizeof(int));
+    }
+    pos->start = start_new;
+    pos->stop = stop_new;
+    pos->size = size_new;
+  }
+  pos->start[pos->len] = start;
+  pos->stop[pos->len] = stop;
+  ++pos->len;
+}
+/*
+ * Split strings on fixed strings or on pre-computed matches
+ *
+ * Equivalent to splitting with `gregexpr(split, strip_ctl(x), fixed=TRUE)`
+ * and then extracting the pieces with `substr_ctl`, as `strsplit_ctl` does for
+ * regular expressions, except we find the split points by scanning a stripped
+ * copy of each element in a re-used buffer, and then extract the pieces of all
+ * the elements with a single call to FANSI_substr.  Pieces are thus identical
+ * to those `strsplit_ctl` produces via `substr_ctl`, including the SGR state
+ * carried into each piece and the closing ESC[0m.
+ *
+ * An empty split splits between every character.
+ *
+ * For regular expressions the matches are computed in R by `gregexpr` on the
+ * stripped strings and supplied via `matches`, in which case `split` is
+ * ignored.  `gregexpr` already uses PCRE (with JIT where available) for
+ * `perl=TRUE`, and is vectorized, so the only thing left to do per element is
+ * to translate the matches into pieces, which we do here.
+ *
+ * @param x a character vector in UTF-8.
+ * @param split a character vector in UTF-8 without NAs, recycled along `x`.
+ * @param matches NULL, or a list as long as `x` of `gregexpr` results in
+ *   characters on the stripped version of each element of `x`, with NULL for
+ *   elements that were not matched.
+ * @return a list as from `strsplit`.
+ */
+SEXP FANSI_strsplit(
+  SEXP x, SEXP split, SEXP matches, SEXP warn, SEXP term_cap, SEXP ctl
+) {
   if(
-    TYPEOF(x) != VECSXP || TYPEOF(warn) != LGLSXP ||
-    TYPEOF(term_cap) != INTSXP
+    TYPEOF(x) != STRSXP || TYPEOF(split) != STRSXP || !XLENGTH(split) ||
+    (
+      matches != R_NilValue &&
+      (TYPEOF(matches) != VECSXP || XLENGTH(matches) != XLENGTH(x))
+    ) ||
+    TYPEOF(warn) != LGLSXP || TYPEOF(term_cap) != INTSXP ||
+    TYPEOF(ctl) != INTSXP
   )
-    error("Internal Error: invalid arguments; contact maintainer.");
-
-  R_xlen_t x_len = xlength(x);
-
-  // Save two spots on protect stack, one for the VECSXP, and then one for each
-  // STRSXP we need to create
+    error("Internal Error: invalid arguments; contact maintainer.");  // nocov
 
-  PROTECT_INDEX ipx;
-  PROTECT_WITH_INDEX(x, &ipx);
+  R_xlen_t x_len = XLENGTH(x);
+  R_xlen_t split_len = XLENGTH(split);
+  int ctl_int = FANSI_ctl_as_int(ctl);
+  int warn_int = asLogical(warn);
+  SEXP sym_match_len = install("match.length");
 
-  SEXP res_vec = x;
+  // Number of pieces for each element, or -1 if not split
 
-  int sgr_in_vec, sgr_in_str;
-  sgr_in_vec = sgr_in_str = 0;
-  struct FANSI_buff buff = {.len=0};
-  char * buff_track = buff.buff;
+  R_xlen_t * pieces = (R_xlen_t *) R_alloc(x_len, sizeof(R_xlen_t));
+  struct split_pos pos = {.len=0, .size=0};
 
+  int buff_size = 0;
   for(R_xlen_t i = 0; i < x_len; ++i) {
+    int chr_len = LENGTH(STRING_ELT(x, i));
+    if(chr_len > buff_size) buff_size = chr_len;
+  }
+  char * buff = R_alloc((size_t) buff_size + 1, sizeof(char));
+  R_xlen_t invalid_idx = 0;
 
-    sgr_in_str = 0;
-
+  for(R_xlen_t i = 0; i < x_len; ++i) {
     FANSI_interrupt(i);
-    SEXP string = VECTOR_ELT(x, i);
-    if(TYPEOF(string) != STRSXP)
-      // nocov start
-      error(
-        "%s%s%s",
-        "Internal Error: result of `strsplit` contains ",
-        type2char(TYPEOF(string)),
-        " instead of expected STRSXP; contact maintainer."
-      );
-      // nocov end
-
-    R_xlen_t chr_len = XLENGTH(string);
-    struct FANSI_state state_prev = FANSI_state_init("", warn, term_cap);
-
-    for(R_xlen_t j = 0; j < chr_len; ++j) {
-
-      FANSI_interrupt(j);
-
-      SEXP chrsxp = STRING_ELT(string, j);
-      FANSI_check_enc(chrsxp, j);
-
-      if(chrsxp != NA_STRING) {
-        const char * chr = CHAR(chrsxp);
-        R_len_t chr_len = LENGTH(chrsxp);
-        const char * chr_track = chr;
-
-        struct FANSI_state state = FANSI_state_init(chr, warn, term_cap);
-
-        // Read all escapes; note we only care about the state at the end of a
-        // string
-
-        while(*chr_track && (chr_track = strchr(chr_track, 0x1b))) {
-          state.pos_byte = (chr_track - chr);
-          state = FANSI_read_next(state);
-          chr_track = chr + state.pos_byte;
-        }
-        int has = FANSI_state_has_style(state);
-        int has_prev = FANSI_state_has_style(state_prev);
-        int chr_size = 0;
-        int chr_size_prev = 0;
-
-        if(has_prev) {
-          chr_size = chr_size_prev = FANSI_state_size(state_prev);
-        }
-        if(has_prev || has) {
-          // really shouldn't overflow
-          chr_size = FANSI_ADD_INT(chr_size, 4);
-
-          if(chr_len > FANSI_int_max - chr_size) {
-            error(
-              "%s%s",
-              "Overflow while attempting to reformat styles on split string; ",
-              "this can happen if you have a sub-string close to INT_MAX long ",
-              "and adding initial / and or ending SGRs would push it over ",
-              "INT_MAX."
-            );
-          }
-          chr_size += chr_len;
-          FANSI_size_buff(&buff, (size_t) chr_size + 1); // + 1 for the NULL
-          buff_track = buff.buff;
-
-          if(!sgr_in_vec) {
-            // re-allocate VECSXP
-            sgr_in_vec = 1;
-            REPROTECT(res_vec = duplicate(x), ipx);
-            // Initiate buffer
-          }
-          if(!sgr_in_str) {
-            // re-allocate STRSXP
-            sgr_in_str = 1;
-            SEXP string_cpy = PROTECT(duplicate(string));
-            SET_VECTOR_ELT(res_vec, i, string_cpy);
-            UNPROTECT(1);
-            string = string_cpy;
-          }
-          if(has_prev) {
-            FANSI_csi_write(buff_track, state_prev, chr_size_prev);
-            buff_track += chr_size_prev;
-          }
-          memcpy(buff_track, chr, chr_len);
-          buff_track += chr_len;
-          memcpy(buff_track, "\033[0m", 4);
-          buff_track += 4;
-          *buff_track = 0;  // not strictly necessary
-
-          SEXP chrsxp_new =
-            PROTECT(mkCharLenCE(buff.buff, chr_size, getCharCE(chrsxp)));
-
-          SET_STRING_ELT(string, j, chrsxp_new);
-          UNPROTECT(1);
-
-          if(has) state_prev = state;
-  } } } }
-  UNPROTECT(1);
-  return res_vec;
+    SEXP chr = STRING_ELT(x, i);
+    pieces[i] = -1;
+    if(chr == NA_STRING) continue;
+    FANSI_check_enc(chr, i);
+
+    // Strip, and count characters in the stripped string
+
+    const char * string = CHAR(chr);
+    int invalid = 0;
+    int bytes = FANSI_strip_chr(
+      string, string + LENGTH(chr), ctl_int, buff, &invalid
+    );
+    if(invalid && !invalid_idx) invalid_idx = i + 1;
+    const char * strip = bytes < 0 ? string : buff;
+    if(bytes < 0) bytes = LENGTH(chr);
+
+    int chars = FANSI_utf8_chars(strip, bytes);
+    if(chars == NA_INTEGER)
+      error("invalid multibyte string, element %.0f", (double) i + 1);
+    if(!chars) {
+      pieces[i] = 0;
+      continue;
+    }
+    // Find the matches, positions are 1 based character offsets
+
+    SEXP split_chr = STRING_ELT(split, i % split_len);
+    const char * sp = CHAR(split_chr);
+    int sp_bytes = LENGTH(split_chr);
+    int sp_chars = FANSI_utf8_chars(sp, sp_bytes);
+    if(sp_chars == NA_INTEGER)
+      error("invalid multibyte string in `split`");
+
+    if(matches != R_NilValue && sp_bytes) {
+      // Mirror the `gregexpr` + `substr_ctl` logic from the R implementation;
+      // a match that reaches the end produces no trailing piece.
+
+      SEXP match = VECTOR_ELT(matches, i);
+      if(TYPEOF(match) != INTSXP || !XLENGTH(match) || INTEGER(match)[0] < 1)
+        continue;
+      SEXP match_len = getAttrib(match, sym_match_len);
+      if(TYPEOF(match_len) != INTSXP || XLENGTH(match_len) != XLENGTH(match))
+        error("Internal Error: bad `match.length`.");  // nocov
+
+      R_xlen_t len_start = pos.len;
+      int start = 1;
+      for(R_xlen_t j = 0; j < XLENGTH(match); ++j) {
+        int m = INTEGER(match)[j];
+        if(start <= chars) split_add(&pos, start, m - 1);
+        start = m + INTEGER(match_len)[j];
+        if(start < 1) start = 1;
+      }
+      if(start <= chars) split_add(&pos, start, chars);
+      pieces[i] = pos.len - len_start;
+      continue;
+    }
+    R_xlen_t len_start = pos.len;
+    int start = 1;
+    int byte = 0, chr_i = 1;  // chr_i is the 1 based position of `byte`
+    while(byte < bytes) {
+      if(
+        sp_bytes ?
+        (sp_bytes <= bytes - byte && !memcmp(strip + byte, sp, sp_bytes)) :
+        chr_i > 1
+      ) {
+        // A split that reaches the end produces no trailing piece
+        split_add(&pos, start, chr_i - 1);
+        start = chr_i + sp_chars;
+        if(sp_bytes) {
+          byte += sp_bytes;
+          chr_i += sp_chars;
+          continue;
+      } }
+      int clen = FANSI_utf8clen(strip[byte]);
+      byte += clen < bytes - byte ? clen : bytes - byte;
+      ++chr_i;
+    }
+    if(pos.len == len_start) continue;  // no matches, keep element as is
+    if(start <= chars) split_add(&pos, start, chars);
+    pieces[i] = pos.len - len_start;
+  }
+  if(invalid_idx) FANSI_strip_warn(R_NilValue, warn_int, invalid_idx);
+
+  // Extract all the pieces in one go
+
+  SEXP x_rep = PROTECT(allocVector(STRSXP, pos.len));
+  SEXP starts = PROTECT(allocVector(INTSXP, pos.len));
+  SEXP stops = PROTECT(allocVector(INTSXP, pos.len));
+  R_xlen_t k = 0;
+  for(R_xlen_t i = 0; i < x_len; ++i) {
+    for(R_xlen_t j = 0; j < pieces[i]; ++j, ++k) {
+      SET_STRING_ELT(x_rep, k, STRING_ELT(x, i));
+      INTEGER(starts)[k] = pos.start[k];
+      INTEGER(stops)[k] = pos.stop[k];
+  } }
+  SEXP type = PROTECT(ScalarInteger(0));
+  SEXP R_true = PROTECT(ScalarLogical(1));
+  SEXP R_false = PROTECT(ScalarLogical(0));
+  SEXP subs = PROTECT(
+    FANSI_substr(
+      x_rep, starts, stops, type, R_true, R_false, warn, term_cap, ctl
+  ) );
+  SEXP res = PROTECT(allocVector(VECSXP, x_len));
+  k = 0;
+  for(R_xlen_t i = 0; i < x_len; ++i) {
+    SEXP chr = STRING_ELT(x, i);
+    SEXP res_i;
+    if(pieces[i] < 0) {
+      res_i = PROTECT(ScalarString(chr));
+    } else {
+      res_i = PROTECT(allocVector(STRSXP, pieces[i]));
+      for(R_xlen_t j = 0; j < pieces[i]; ++j, ++k)
+        SET_STRING_ELT(res_i, j, STRING_ELT(subs, k));
+    }
+    SET_VECTOR_ELT(res, i, res_i);
+    UNPROTECT(1);
+  }
+  UNPROTECT(8);
+  return res;
 }
-// nocov end
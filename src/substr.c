@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2020  Brodie Gaslam
+ *
+ * This file is part of "fansi - ANSI Control Sequence Aware String Functions"
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
+ */
+
+#include "fansi.h"
+
+/*
+ * Track the byte offset of a character position in a string
+ *
+ * ESC sequences are counted in `pos.ansi` one byte at a time, so for malformed
+ * sequences that consume part of a UTF-8 character `pos.byte` may land in the
+ * middle of a character.  Like `substr` we instead count UTF-8 characters to
+ * find the byte offsets for the `pos.ansi` positions.
+ *
+ * Positions are usually requested in increasing order so we keep a cursor and
+ * only restart from the beginning, or from a checkpoint (see below), if we
+ * need to go back.
+ */
+struct chr_cursor {const char * string; int chr; int byte;};
+
+static int chr_to_byte(struct chr_cursor * cursor, int chr) {
+  if(chr < cursor->chr) cursor->chr = cursor->byte = 0;
+  const char * string = cursor->string;
+  while(cursor->chr < chr && string[cursor->byte]) {
+    int chr_len = FANSI_utf8clen(string[cursor->byte]);
+    int i = 1;
+    while(i < chr_len && string[cursor->byte + i]) ++i;  // truncated UTF-8
+    cursor->byte += i;
+    ++cursor->chr;
+  }
+  return cursor->byte;
+}
+/*
+ * Checkpoints for long strings
+ *
+ * When a long string is queried at positions that are not increasing we would
+ * have to re-read it from the beginning for every position that is earlier
+ * than the prior one.  Instead, the first time we go back in a string longer
+ * than SUBSTR_CHECK_MIN bytes we start recording the state every
+ * SUBSTR_CHECK_EVERY characters (or width units), along with the
+ * corresponding `chr_cursor`, and resume from the last checkpoint before the
+ * requested position.  Checkpoints are only recorded up to the positions that
+ * are requested, so each position costs at most SUBSTR_CHECK_EVERY units of
+ * reading once the checkpoints covering it exist.
+ *
+ * The checkpoints are states returned by `FANSI_state_at_position` for earlier
+ * positions, which we already rely on being equivalent to reading from the
+ * beginning when continuing from one element to the next.
+ */
+#define SUBSTR_CHECK_EVERY 1024
+#define SUBSTR_CHECK_MIN (16 * SUBSTR_CHECK_EVERY)
+
+struct substr_check {
+  struct FANSI_state_pair pair;
+  struct chr_cursor cursor;
+};
+struct substr_checks {
+  struct substr_check * x;
+  int len, size;
+  int done;   // whether the last checkpoint is at the end of the string
+};
+static int check_pos(struct substr_check * check, int type) {
+  return type ? check->pair.cur.pos.width : check->pair.cur.pos.raw;
+}
+/*
+ * Return the last checkpoint before `pos`, adding checkpoints as needed.
+ * `checks` must already contain the checkpoint for the beginning of the
+ * string.
+ *
+ * @param warn pointer to the warning flag of the current run of the string.
+ *   It is used while adding checkpoints, and updated if adding them warned,
+ *   so we only warn once per run.
+ */
+static struct substr_check * check_before(
+  struct substr_checks * checks, int pos, int type, int * warn
+) {
+  while(
+    !checks->done &&
+    check_pos(checks->x + checks->len - 1, type) + SUBSTR_CHECK_EVERY < pos
+  ) {
+    if(checks->len >= checks->size) {
+      if(checks->size > INT_MAX / 2)
+        error("Internal Error: too many checkpoints.");  // nocov
+      int size_new = checks->size * 2;
+      struct substr_check * x_new = (struct substr_check *)
+        R_alloc(size_new, sizeof(struct substr_check));
+      memcpy(x_new, checks->x, checks->len * sizeof(struct substr_check));
+      checks->x = x_new;
+      checks->size = size_new;
+    }
+    struct substr_check * last = checks->x + checks->len - 1;
+    struct substr_check * next = last + 1;
+    int pos_next = check_pos(last, type) + SUBSTR_CHECK_EVERY;
+    last->pair.cur.warn = last->pair.prev.warn = *warn;
+    next->pair = FANSI_state_at_position(pos_next, last->pair, type, 0, 0);
+    *warn = next->pair.cur.warn;
+    if(check_pos(next, type) < pos_next) checks->done = 1;  // end of string
+    if(check_pos(next, type) <= check_pos(last, type)) break;
+    next->cursor = last->cursor;
+    chr_to_byte(&next->cursor, next->pair.cur.pos.ansi);
+    ++checks->len;
+  }
+  // Checkpoints are sorted so we can binary search them
+
+  int lo = 0, hi = checks->len - 1;
+  while(lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if(check_pos(checks->x + mid, type) < pos) lo = mid;
+    else hi = mid - 1;
+  }
+  return checks->x + lo;
+}
+/*
+ * Substring a character vector
+ *
+ * For each element we compute the state at the start and stop positions, and
+ * then write the start state as an SGR sequence, the bytes in between the two
+ * positions, and a closing ESC[0m if the stop position is in a styled region,
+ * into a single buffer.
+ *
+ * When consecutive elements are the same string and the positions increase
+ * (e.g. as in `strsplit_ctl`) we continue from the state of the prior element
+ * instead of re-reading the string from the beginning.
+ *
+ * @param x a character vector in UTF-8, either of length one, in which case it
+ *   is recycled, or the same length as `start`.  May not contain NAs.
+ * @param start integer start positions, 1 indexed and at least 1.
+ * @param stop integer stop positions, same length as `start`.  Elements with
+ *   `stop` less than `start` or zero become empty strings.
+ * @param type 0 for characters, 1 for width.
+ * @param round_start,round_stop TRUE or FALSE, whether to round to include a
+ *   partially covered wide character at the start and stop respectively.
+ */
+SEXP FANSI_substr(
+  SEXP x, SEXP start, SEXP stop, SEXP type, SEXP round_start, SEXP round_stop,
+  SEXP warn, SEXP term_cap, SEXP ctl
+) {
+  /*******************************************\
+  * IMPORTANT: INPUT MUST ALREADY BE IN UTF8! *
+  \*******************************************/
+
+  // no errors should make it here, it should be handled R side
+  if(TYPEOF(x) != STRSXP)
+    error("Internal Error: `x` must be character");              // nocov
+  if(TYPEOF(start) != INTSXP || TYPEOF(stop) != INTSXP)
+    error("Internal Error: `start` and `stop` must be integer");  // nocov
+  if(XLENGTH(start) != XLENGTH(stop))
+    error("Internal Error: `start` and `stop` must be same length");  // nocov
+  if(XLENGTH(x) != 1 && XLENGTH(x) != XLENGTH(start))
+    error("Internal Error: `x` must be length 1 or same as `start`");  // nocov
+  if(TYPEOF(type) != INTSXP || XLENGTH(type) != 1)
+    error("Internal Error: `type` must be scalar integer");      // nocov
+  if(
+    TYPEOF(round_start) != LGLSXP || XLENGTH(round_start) != 1 ||
+    TYPEOF(round_stop) != LGLSXP || XLENGTH(round_stop) != 1
+  )
+    error("Internal Error: `round_*` must be TRUE or FALSE");    // nocov
+
+  R_xlen_t len = XLENGTH(start);
+  int x_scalar = XLENGTH(x) == 1;
+  int type_int = asInteger(type);
+  int lag_start = asLogical(round_start);
+  int lag_stop = asLogical(round_stop);
+  int * start_int = INTEGER(start);
+  int * stop_int = INTEGER(stop);
+
+  SEXP R_true = PROTECT(ScalarLogical(1));
+  struct FANSI_state state_init =
+    FANSI_state_init_full("", warn, term_cap, R_true, R_true, type, ctl);
+  UNPROTECT(1);
+
+  struct FANSI_state_pair state_pair = {.cur=state_init, .prev=state_init};
+  struct FANSI_buff buff = {.len=0};
+  SEXP res = PROTECT(allocVector(STRSXP, len));
+  SEXP chr_prev = NULL;
+  int pos_prev = -1;
+  struct chr_cursor cursor = {.string="", .chr=0, .byte=0};
+  struct substr_checks checks = {.x=NULL, .len=0, .size=0, .done=0};
+
+  for(R_xlen_t i = 0; i < len; ++i) {
+    FANSI_interrupt(i);
+    int start_i = start_int[i];
+    int stop_i = stop_int[i];
+
+    if(start_i == NA_INTEGER || stop_i == NA_INTEGER || start_i < 1)
+      error("Internal Error: illegal `start` or `stop` values.");  // nocov
+    if(stop_i < start_i) continue;   // allocVector initializes to ""
+
+    SEXP chr = STRING_ELT(x, x_scalar ? 0 : i);
+    if(chr == NA_STRING)
+      error("Internal Error: NAs not allowed"); // nocov
+    FANSI_check_enc(chr, i);
+    const char * string = CHAR(chr);
+
+    // Start from scratch unless we can continue from the prior element, but
+    // only warn once for each run of the same string.
+
+    if(chr != chr_prev) {
+      cursor = (struct chr_cursor){.string=string, .chr=0, .byte=0};
+      checks.len = checks.done = 0;
+    }
+    if(chr != chr_prev || start_i - 1 <= pos_prev) {
+      struct FANSI_state state = state_init;
+      state.string = string;
+      if(chr == chr_prev) state.warn = state_pair.cur.warn;
+      state_pair.cur = state_pair.prev = state;
+
+      // Going back in a long string, resume from a checkpoint instead
+
+      if(chr == chr_prev && LENGTH(chr) > SUBSTR_CHECK_MIN) {
+        if(!checks.len) {
+          if(!checks.size) {
+            checks.size = 64;
+            checks.x = (struct substr_check *)
+              R_alloc(checks.size, sizeof(struct substr_check));
+          }
+          checks.x[0].pair = state_pair;
+          checks.x[0].cursor =
+            (struct chr_cursor){.string=string, .chr=0, .byte=0};
+          checks.len = 1;
+        }
+        struct substr_check * check = check_before(
+          &checks, start_i - 1, type_int, &state.warn
+        );
+        state_pair = check->pair;
+        state_pair.cur.warn = state_pair.prev.warn = state.warn;
+        if(cursor.chr > check->cursor.chr) cursor = check->cursor;
+      }
+    }
+    state_pair = FANSI_state_at_position(
+      start_i - 1, state_pair, type_int, lag_start, 0
+    );
+    struct FANSI_state state_start = state_pair.cur;
+
+    // We need to allow the same position for start and stop
+
+    if(stop_i == start_i) state_pair.cur = state_pair.prev;
+    state_pair = FANSI_state_at_position(
+      stop_i - 1, state_pair, type_int, lag_stop, 1
+    );
+    struct FANSI_state state_stop = state_pair.cur;
+    chr_prev = chr;
+    pos_prev = stop_i - 1;
+
+    // The stop state is at the beginning of the last character to include
+
+    int byte_start = chr_to_byte(&cursor, state_start.pos.ansi);
+    int byte_stop = chr_to_byte(&cursor, state_stop.pos.ansi + 1);
+    int bytes_body = byte_stop > byte_start ? byte_stop - byte_start : 0;
+    int bytes_start = FANSI_style_size(state_start.sgr);
+    int bytes_stop = FANSI_style_has(state_stop.sgr) ? 4 : 0;
+
+    if(bytes_body > FANSI_int_max - bytes_start - bytes_stop)
+      error(
+        "%s%s %.0f %s",
+        "Substring with SGR sequences is longer than INT_MAX ",
+        "at position", (double) (i + 1), "which is not allowed by R."
+      );
+    FANSI_size_buff(&buff, (size_t) bytes_start + bytes_body + bytes_stop + 1);
+
+    char * buff_track = buff.buff;
+    buff_track += FANSI_csi_write(buff_track, state_start.sgr, bytes_start);
+    memcpy(buff_track, string + byte_start, bytes_body);
+    buff_track += bytes_body;
+    if(bytes_stop) {
+      memcpy(buff_track, "\033[0m", bytes_stop);
+      buff_track += bytes_stop;
+    }
+    *buff_track = 0;
+
+    SEXP res_chr = PROTECT(
+      mkCharLenCE(buff.buff, (int) (buff_track - buff.buff), getCharCE(chr))
+    );
+    SET_STRING_ELT(res, i, res_chr);
+    UNPROTECT(1);
+  }
+  UNPROTECT(1);
+  return res;
+}
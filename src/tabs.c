@@ -27,13 +27,13 @@ int FANSI_tab_width(struct FANSI_state state, SEXP tab_stops) {
   R_xlen_t stops = XLENGTH(tab_stops);
   if(!stops)
     error("Internal Error: must have at least one tab stop");  // nocov
-  if(*(state.string + state.pos_byte) != '\t')
+  if(*(state.string + state.pos.byte) != '\t')
     error("Internal Error: computing tab width on not a tab"); // nocov
 
   int tab_width = 0;
   R_xlen_t stop_idx = 0;
 
-  while(state.pos_width >= tab_width) {
+  while(state.pos.width >= tab_width) {
     int stop_size = INTEGER(tab_stops)[stop_idx];
     if(stop_size < 1)
       error("Internal Error: stop size less than 1.");  // nocov
@@ -42,7 +42,7 @@ int FANSI_tab_width(struct FANSI_state state, SEXP tab_stops) {
     tab_width += stop_size;
     if(stop_idx < stops - 1) stop_idx++;
   }
-  return tab_width - state.pos_width;
+  return tab_width - state.pos.width;
 }
 
 SEXP FANSI_tabs_as_spaces(
@@ -121,33 +121,33 @@ SEXP FANSI_tabs_as_spaces(
       char * buff_track, * buff_start;
       buff_track = buff_start = buff->buff;
 
-      int last_byte = state.pos_byte;
+      int last_byte = state.pos.byte;
       int warn_old = state.warn;
 
       while(1) {
-        cur_chr = state.string[state.pos_byte];
+        cur_chr = state.string[state.pos.byte];
         int extra_spaces = 0;
 
         if(cur_chr == '\t') {
           extra_spaces = FANSI_tab_width(state, tab_stops);
         } else if (cur_chr == '\n') {
-          state = FANSI_reset_width(state);
+          FANSI_reset_width(&state);
         }
         // Write string
 
         if(cur_chr == '\t' || !cur_chr) {
-          int write_bytes = state.pos_byte - last_byte;
+          int write_bytes = state.pos.byte - last_byte;
           memcpy(buff_track, state.string + last_byte, write_bytes);
           buff_track += write_bytes;
 
           // consume tab and advance
 
           state.warn = 0;
-          state = FANSI_read_next(state);
+          FANSI_read_next(&state);
           state.warn = warn_old;
-          cur_chr = state.string[state.pos_byte];
-          state = FANSI_inc_width(state, extra_spaces);
-          last_byte = state.pos_byte;
+          cur_chr = state.string[state.pos.byte];
+          FANSI_inc_width(&state, extra_spaces);
+          last_byte = state.pos.byte;
 
           // actually write the extra spaces
 
@@ -159,7 +159,7 @@ SEXP FANSI_tabs_as_spaces(
           if(!cur_chr) *buff_track = 0;
         }
         if(!cur_chr) break;
-        state = FANSI_read_next(state);
+        if(!FANSI_read_ascii(&state, NULL, INT_MAX, 1)) FANSI_read_next(&state);
       }
       // Write the CHARSXP
 
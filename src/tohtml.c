@@ -52,18 +52,14 @@ static const struct FANSI_css css_style[9] = {
  *
  * <https://en.wikipedia.org/wiki/ANSI_escape_code>
  *
- * @param color an integer expected to be between 0 and 9
- * @param color_extra a pointer to a 4 long integer array as you would get in
- *   struct FANSI_state.color_extra
+ * @param color an encoded color as in struct FANSI_style.color
  * @param buff must be pre-allocated to be able to hold the color in format
  *   #FFFFFF including the null terminator (so at least 8 bytes)
  * @return how many bytes were written, guaranteed to be 7 bytes, does not
  *   include the NULL terminator that is also written just in case.
  */
 
-static int color_to_html(
-  int color, int * color_extra, char * buff
-) {
+static int color_to_html(uint32_t color, char * buff) {
   // CAREFUL: DON'T WRITE MORE THAN 7 BYTES + NULL TERMINATOR
 
   const char * dectohex = "0123456789ABCDEF";
@@ -86,170 +82,297 @@ static int color_to_html(
     "5555FF", "FF55FF", "55FFFF", "FFFFFF"
   };
   char * buff_track = buff;
+  uint32_t val = FANSI_CLR_VAL(color);
 
-  if(color == 9) {
-    error(
-      "Internal Error: should not be applying no-color; contact maintainer."
-    );
-  } else if(color >= 0 && color < 10) {
-    *(buff_track++) = '#';
-
-    if(color == 8) {
-      if(color_extra[0] == 2) {
-        for(int i = 1; i < 4; ++i) {
-          char hi = dectohex[color_extra[i] / 16];
-          char lo = dectohex[color_extra[i] % 16];
+  *(buff_track++) = '#';
+  switch(FANSI_CLR_TYPE(color)) {
+    case FANSI_CLR_8:
+      memcpy(buff_track, std_8[val], 6);
+      buff_track += 6;
+      break;
+    case FANSI_CLR_BRIGHT:
+      memcpy(buff_track, bright[val], 6);
+      buff_track += 6;
+      break;
+    case FANSI_CLR_TRU:
+      for(int i = 16; i >= 0; i -= 8) {
+        *(buff_track++) = dectohex[(val >> i & 0xFF) / 16];
+        *(buff_track++) = dectohex[(val >> i & 0xFF) % 16];
+      }
+      break;
+    case FANSI_CLR_256: {
+      // These are the 0-255 color codes
+      int color_5 = (int) val;
+      if(color_5 > 255)
+        error("Internal Error: 0-255 color outside of that range."); // nocov
+      if(color_5 < 16) {
+        // Standard colors
+        memcpy(buff_track, std_16[color_5], 6);
+        buff_track += 6;
+      } else if (color_5 < 232) {
+        int c5 = color_5 - 16;
+        int c5_r = c5 / 36;
+        int c5_g = (c5 % 36) / 6;
+        int c5_b = c5 % 6;
+
+        if(c5_r > 5 || c5_g > 5 || c5_b > 5)
+          error("Internal Error: out of bounds computing 6^3 clr."); // nocov
+
+        memcpy(buff_track, std_5[c5_r], 2);
+        buff_track += 2;
+        memcpy(buff_track, std_5[c5_g], 2);
+        buff_track += 2;
+        memcpy(buff_track, std_5[c5_b], 2);
+        buff_track += 2;
+      } else {
+        int c_bw = (color_5 - 232) * 10 + 8;
+        char hi = dectohex[c_bw / 16];
+        char lo = dectohex[c_bw % 16];
+        for(int i = 0; i < 3; ++i) {
           *(buff_track++) = hi;
           *(buff_track++) = lo;
         }
-      } else if(color_extra[0] == 5) {
-        // These are the 0-255 color codes
-        int color_5 = color_extra[1];
-        if(color_5 < 0 || color_5 > 255)
-          error("Internal Error: 0-255 color outside of that range."); // nocov
-        if(color_5 < 16) {
-          // Standard colors
-          memcpy(buff_track, std_16[color_5], 6);
-          buff_track += 6;
-        } else if (color_5 < 232) {
-          int c5 = color_5 - 16;
-          int c5_r = c5 / 36;
-          int c5_g = (c5 % 36) / 6;
-          int c5_b = c5 % 6;
-
-          if(c5_r > 5 || c5_g > 5 || c5_b > 5)
-            error("Internal Error: out of bounds computing 6^3 clr."); // nocov
-
-          memcpy(buff_track, std_5[c5_r], 2);
-          buff_track += 2;
-          memcpy(buff_track, std_5[c5_g], 2);
-          buff_track += 2;
-          memcpy(buff_track, std_5[c5_b], 2);
-          buff_track += 2;
-        } else {
-          int c_bw = (color_5 - 232) * 10 + 8;
-          char hi = dectohex[c_bw / 16];
-          char lo = dectohex[c_bw % 16];
-          for(int i = 0; i < 3; ++i) {
-            *(buff_track++) = hi;
-            *(buff_track++) = lo;
-          }
-        }
-      } else
-        // nocov start
-        error(
-          "Internal Error: invalid 256 or tru color code; contact maintainer."
-        );
-        // nocov end
-    } else {
-      memcpy(buff_track, std_8[color], 6);
-      buff_track += 6;
+      }
+      break;
     }
-  } else if(
-    (color >= 90 && color <= 97) ||
-    (color >= 100 && color <= 107)
-  ) {
-    *(buff_track++) = '#';
-    int c_bright = color >= 100 ? color - 100 : color - 90;
-    memcpy(buff_track, bright[c_bright], 6);
-    buff_track += 6;
-  } else {
-    error("Internal Error: invalid color code %d", color); // nocov
+    default:
+      // nocov start
+      error(
+        "Internal Error: should not be applying no-color; contact maintainer."
+      );
+      // nocov end
   }
   *buff_track = 0;
   return (int) (buff_track - buff);
 }
 
-static int state_as_html(struct FANSI_state state, int first, char * buff) {
+/*
+ * Write the CSS declarations for the basic styles of `sgr`, e.g.
+ * "color: #BB0000;font-weight: bold;", and NULL terminate them.
+ *
+ * @return how many bytes were written, excluding the NULL terminator.
+ */
+static int style_as_css(struct FANSI_style sgr, char * buff) {
   /****************************************************\
   | IMPORTANT: KEEP THIS ALIGNED WITH FANSI_csi_write  |
   | although right now ignoring rare escapes in html   |
   \****************************************************/
+  const char * buff_start = buff;
+
+  // Colors color: #FFFFFF; background-color: #FFFFFF;
+
+  int invert = sgr.style & (1 << 7);
+  uint32_t color = invert ? sgr.bg_color : sgr.color;
+  uint32_t bg_color = invert ? sgr.color : sgr.bg_color;
+
+  if(color) {
+    memcpy(buff, "color: ", 7);
+    buff += 7;
+    buff += color_to_html(color, buff);
+    *(buff++) = ';';
+  }
+  if(bg_color) {
+    memcpy(buff, "background-color: ", 18);
+    buff += 18;
+    buff += color_to_html(bg_color, buff);
+    *(buff++) = ';';
+  }
+  // Styles (need to go after color for transparent to work)
+
+  for(int i = 1; i < 10; ++i) {
+    if(sgr.style & (1 << i)) {
+      memcpy(buff, css_style[i - 1].css, css_style[i - 1].len);
+      buff += css_style[i - 1].len;
+    }
+  }
+  *buff = 0;
+  return (int)(buff - buff_start);
+}
+/*
+ * Compute size of the output of `style_as_css`
+ */
+static int style_size_as_css(struct FANSI_style sgr) {
+  int size = 0;
+  for(int i = 1; i < 10; ++i) {
+    if(sgr.style & (1 << i)) size += css_style[i - 1].len;
+  }
+  // Colors color: #FFFFFF; background-color: #FFFFFF;
+
+  int invert = sgr.style & (1 << 7);
+  if(sgr.color) size += invert ? 26 : 15;
+  if(sgr.bg_color) size += invert ? 15 : 26;
+  return size;
+}
+/*
+ * Interned styles for the CSS class mode of `FANSI_esc_to_html`
+ *
+ * Each distinct combination of the basic styles is assigned a class, numbered
+ * in order of first use.  Lookup is via an open addressing hash table keyed on
+ * the packed style.
+ *
+ * `slots` holds indices into `styles` plus one, or zero for empty slots, and
+ * `styles` has room for half as many entries as there are `slots` so that the
+ * table is at most half full.
+ */
+struct html_classes {
+  struct FANSI_style * styles;
+  int * slots;
+  int size;      // number of `slots`, a power of 2
+  int count;     // number of `styles` in use
+};
+static uint32_t html_style_hash(struct FANSI_style sgr) {
+  uint32_t h = sgr.color * 0x9E3779B1U;
+  h = (h ^ sgr.bg_color) * 0x85EBCA6BU;
+  h = (h ^ sgr.style) * 0xC2B2AE35U;
+  return h ^ (h >> 16);
+}
+static void html_classes_alloc(struct html_classes * classes, int size) {
+  struct FANSI_style * styles_old = classes->styles;
+  classes->slots = (int *) R_alloc(size, sizeof(int));
+  memset(classes->slots, 0, size * sizeof(int));
+  classes->styles =
+    (struct FANSI_style *) R_alloc(size / 2, sizeof(struct FANSI_style));
+  classes->size = size;
+
+  for(int i = 0; i < classes->count; ++i) {
+    classes->styles[i] = styles_old[i];
+    uint32_t j = html_style_hash(styles_old[i]) & (size - 1);
+    while(classes->slots[j]) j = (j + 1) & (size - 1);
+    classes->slots[j] = i + 1;
+  }
+}
+/*
+ * Look up, and if necessary add, the class for the basic styles of `sgr`
+ *
+ * @return the index of the class, or -1 if we are not using classes or there
+ *   is no style.
+ */
+static int html_class(struct html_classes * classes, struct FANSI_style sgr) {
+  if(!classes->size || !FANSI_style_has_basic(sgr)) return -1;
+
+  // Only the basic styles are translated, so only those distinguish classes
+
+  struct FANSI_style key = {
+    .color=sgr.color, .bg_color=sgr.bg_color, .style=sgr.style & 1023
+  };
+  uint32_t mask = classes->size - 1;
+  uint32_t j = html_style_hash(key) & mask;
+
+  while(classes->slots[j]) {
+    int idx = classes->slots[j] - 1;
+    if(!FANSI_style_comp(key, classes->styles[idx])) return idx;
+    j = (j + 1) & mask;
+  }
+  if(classes->count >= classes->size / 2) {
+    if(classes->size > INT_MAX / 2)
+      error("Internal Error: too many distinct styles.");  // nocov
+    html_classes_alloc(classes, classes->size * 2);
+    return html_class(classes, sgr);
+  }
+  classes->styles[classes->count] = key;
+  classes->slots[j] = ++classes->count;
+  return classes->count - 1;
+}
+/*
+ * Generate the <style> block defining the classes used
+ */
+static SEXP html_classes_as_style(struct html_classes * classes) {
+  const char * open = "<style>\n", * close = "</style>";
+  size_t size = strlen(open) + strlen(close);
+
+  // .f0 {color: #BB0000;}\n
+
+  for(int i = 0; i < classes->count; ++i)
+    size += 2 + FANSI_digits_in_int(i) + 2 +
+      style_size_as_css(classes->styles[i]) + 2;
+
+  if(size > (size_t) FANSI_int_max)
+    error(
+      "%s%s",
+      "CSS style block for SGR classes is longer than INT_MAX, which is not ",
+      "allowed by R."
+    );
+  char * buff = R_alloc(size + 1, sizeof(char));
+  char * buff_track = buff;
+
+  memcpy(buff_track, open, strlen(open));
+  buff_track += strlen(open);
+  for(int i = 0; i < classes->count; ++i) {
+    buff_track += sprintf(buff_track, ".f%d {", i);
+    buff_track += style_as_css(classes->styles[i], buff_track);
+    memcpy(buff_track, "}\n", 2);
+    buff_track += 2;
+  }
+  memcpy(buff_track, close, strlen(close));
+  buff_track += strlen(close);
+  *buff_track = 0;
 
+  SEXP res = PROTECT(allocVector(STRSXP, 1));
+  SET_STRING_ELT(res, 0, mkCharLenCE(buff, (int) size, CE_UTF8));
+  UNPROTECT(1);
+  return res;
+}
+/*
+ * @param cls the CSS class to use for the span, or -1 to use inline styles.
+ */
+static int state_as_html(
+  struct FANSI_state state, int first, int cls, char * buff
+) {
   // Styles
   const char * buff_start = buff;
-  if(!FANSI_state_has_style_basic(state)) {
+  if(!FANSI_style_has_basic(state.sgr)) {
     if(first)
       // nocov start
       error("Internal Error: no state in first span; contact maintainer.");
       // nocov end
-    if(state.string[state.pos_byte]) {
+    if(state.string[state.pos.byte]) {
       memcpy(buff, "</span><span>", 13);
       buff += 13;
     }
   } else {
-    if(first) {
-      memcpy(buff, "<span style='", 13);
-      buff += 13;
-    } else {
-      memcpy(buff, "</span><span style='", 20);
-      buff += 20;
-    }
-    // Colors color: #FFFFFF; background-color: #FFFFFF;
-
-    int invert = state.style & (1 << 7);
-    int color = invert ? state.bg_color : state.color;
-    int * color_extra = invert ? state.bg_color_extra : state.color_extra;
-    int bg_color = invert ? state.color : state.bg_color;
-    int * bg_color_extra = invert ? state.color_extra : state.bg_color_extra;
-
-    if(color >= 0) {
-      memcpy(buff, "color: ", 7);
+    if(!first) {
+      memcpy(buff, "</span>", 7);
       buff += 7;
-      buff += color_to_html(color, color_extra, buff);
-      *(buff++) = ';';
-    }
-    if(bg_color >= 0) {
-      memcpy(buff, "background-color: ", 18);
-      buff += 18;
-      buff += color_to_html(bg_color, bg_color_extra, buff);
-      *(buff++) = ';';
     }
-    // Styles (need to go after color for transparent to work)
-
-    for(int i = 1; i < 10; ++i) {
-      if(state.style & (1 << i)) {
-        memcpy(buff, css_style[i - 1].css, css_style[i - 1].len);
-        buff += css_style[i - 1].len;
-      }
+    if(cls >= 0) {
+      buff += sprintf(buff, "<span class='f%d'>", cls);
+    } else {
+      memcpy(buff, "<span style='", 13);
+      buff += 13;
+      buff += style_as_css(state.sgr, buff);
+      *(buff++) = '\'';
+      *(buff++) = '>';
+      *buff = 0;
     }
-    *(buff++) = '\'';
-    *(buff++) = '>';
-    *buff = 0;
   }
   return (int)(buff - buff_start);
 }
 /*
  * Compute size of each state
  */
-static int state_size_as_html(struct FANSI_state state, int first) {
+static int state_size_as_html(struct FANSI_state state, int first, int cls) {
   int size = 0;
-  if(!FANSI_state_has_style_basic(state)) {
+  if(!FANSI_style_has_basic(state.sgr)) {
     if(first)
       // nocov start
       error("Internal Error: no state in first span; contact maintainer.");
       // nocov end
 
     // Only need to re-open tag if not at end of string
-    if(state.string[state.pos_byte]) {
+    if(state.string[state.pos.byte]) {
       size = 13;  // </span><span>
     }
   } else {
     if(first) {
-      size = 15;  // <span style="">
+      size = 0;
     } else {
-      size = 22;  // </span><span style="">
+      size = 7;  // </span>
     }
-    // Styles
-
-    for(int i = 1; i < 10; ++i) {
-      if(state.style & (1 << i)) size += css_style[i - 1].len;
+    if(cls >= 0) {
+      size += 16 + FANSI_digits_in_int(cls);  // <span class='f0'>
+    } else {
+      size += 15 + style_size_as_css(state.sgr);  // <span style=''>
     }
-    // Colors color: #FFFFFF; background-color: #FFFFFF;
-
-    int invert = state.style & (1 << 7);
-    if(state.color >= 0) size += invert ? 26 : 15;
-    if(state.bg_color >= 0) size += invert ? 15 : 26;
   }
   return size;
 }
@@ -260,13 +383,13 @@ static int state_size_as_html(struct FANSI_state state, int first) {
 
 static int html_compute_size(
   struct FANSI_state state, int bytes_extra, int bytes_esc_start, int first,
-  R_xlen_t i
+  int cls, R_xlen_t i
 ) {
   // bytes_esc cannot overflow int because the input is supposed to be an
   // R sourced string
 
-  int bytes_esc = state.pos_byte - bytes_esc_start;
-  int bytes_html = state_size_as_html(state, first);
+  int bytes_esc = state.pos.byte - bytes_esc_start;
+  int bytes_html = state_size_as_html(state, first, cls);
   int bytes_net = bytes_html - bytes_esc;
 
   if(bytes_net >= 0) {
@@ -343,9 +466,32 @@ static size_t html_check_overflow(
   bytes_final = (size_t) bytes_init + bytes_extra + span_extra + 1;
   return bytes_final;
 }
-SEXP FANSI_esc_to_html(SEXP x, SEXP warn, SEXP term_cap) {
+/*
+ * Make room for `size` more bytes plus the NULL terminator in `buff`, of which
+ * the first `used` are in use.
+ *
+ * @return 0 if that would make the string longer than INT_MAX, in which case the
+ *   buffer is left untouched, 1 otherwise.
+ */
+static int html_reserve(struct FANSI_buff * buff, size_t used, size_t size) {
+  if(size > (size_t) FANSI_int_max || used > (size_t) FANSI_int_max - size)
+    return 0;
+  FANSI_grow_buff(buff, used, used + size + 1);
+  return 1;
+}
+/*
+ * @param classes TRUE or FALSE, whether to use CSS classes instead of inline
+ *   styles, in which case the result has a "style" attribute containing a
+ *   <style> block that defines the classes.
+ */
+SEXP FANSI_esc_to_html(SEXP x, SEXP warn, SEXP term_cap, SEXP classes) {
   if(TYPEOF(x) != STRSXP)
     error("Internal Error: `x` must be a character vector");  // nocov
+  if(TYPEOF(classes) != LGLSXP || XLENGTH(classes) != 1)
+    error("Internal Error: `classes` must be TRUE or FALSE");  // nocov
+
+  struct html_classes cls_tbl = {.size=0, .count=0};
+  if(asLogical(classes) == 1) html_classes_alloc(&cls_tbl, 64);
 
   R_xlen_t x_len = XLENGTH(x);
   struct FANSI_buff buff = {.len=0};
@@ -369,169 +515,161 @@ SEXP FANSI_esc_to_html(SEXP x, SEXP warn, SEXP term_cap) {
     // Reset position info and string; we want to preserve the rest of the state
     // info so that SGR styles can spill across lines
 
-    state = FANSI_reset_pos(state);
+    FANSI_reset_pos(&state);
     state.string = string;
-    struct FANSI_state state_start = FANSI_reset_pos(state);
-
-    // Save what the state was at the end of the prior string
 
     R_len_t bytes_init = LENGTH(chrsxp);
 
-    int bytes_extra = 0;   // Net bytes being add via tags (css - ESC)
-    size_t bytes_final = 0;
-    int has_esc, any_esc;
-    has_esc = any_esc = 0;
-
-    // Process the strings in two passes, in pass 1 we compute how many bytes
-    // we'll need to store the string, and in the second we actually write it.
-    // This is obviously a bit wasteful as we parse the ESC sequences twice, but
-    // the alternative is to track a growing list or some such of accrued parsed
-    // sequences.  The latter might be faster, but more work for us so we'll
-    // leave it and see if it becomes a major issue.
+    // Strings without ESC sequences or left-over state are returned as is.
+
+    int has_esc = FANSI_style_has_basic(state.sgr);
+    if(!has_esc && !strchr(string, 0x1b)) continue;
+
+    // Process the string in a single pass, writing to a buffer that grows as
+    // needed.  We start with enough room for the input plus some headroom for
+    // the tags.
+    //
+    // `bytes_extra` is an upper bound of the net bytes added via tags (css -
+    // ESC) used to produce the overflow errors.  Since it is an upper bound,
+    // if we run out of space before those errors are thrown they are sure to be
+    // thrown later, so we stop writing and just keep parsing until then.
+
+    int bytes_extra = 0;
+    int first_esc = 1;
+    int overflow = 0;
+    size_t bytes_used = 0;
+    size_t bytes_start = (size_t) bytes_init + (bytes_init >> 2) + 128;
+    if(bytes_start > (size_t) FANSI_int_max + 1)
+      bytes_start = (size_t) FANSI_int_max + 1;
+    FANSI_size_buff(&buff, bytes_start);
 
     // It is possible for a state to be left over from prior string.
 
-    if(FANSI_state_has_style_basic(state)) {
+    if(has_esc) {
+      int cls = html_class(&cls_tbl, state.sgr);
       bytes_extra = html_compute_size(
-        state, bytes_extra, state.pos_byte, 0, i
+        state, bytes_extra, state.pos.byte, 0, cls, i
       );
-      has_esc = any_esc = 1;
+      if(
+        html_reserve(
+          &buff, bytes_used, state_size_as_html(state, first_esc, cls)
+      ) )
+        bytes_used +=
+          state_as_html(state, first_esc, cls, buff.buff + bytes_used);
+      else overflow = 1;
+      first_esc = 0;
     }
     state_prev = state;
 
-    // Now check string proper
+    // Deal with state changes in this string
 
     while(*string && (string = strchr(string, 0x1b))) {
-      if(!any_esc) any_esc = 1;
-
       // Since we don't care about width, etc, we only use the state objects to
       // parse the ESC sequences, so we don't have to worry about UTF8
       // conversions.
 
-      state.pos_byte = (string - string_start);
+      state.pos.byte = (string - string_start);
 
-      // read all sequential ESC tags and compute the net change in size to hold
-      // them
+      // read all sequential ESC tags
 
-      int esc_start = state.pos_byte;
-      state = FANSI_read_next(state);
-      if(FANSI_state_comp_basic(state, state_prev)) {
-        bytes_extra =
-          html_compute_size(state, bytes_extra, esc_start, !has_esc, i);
-        if(!has_esc) has_esc = 1;
-      }
-      state_prev = state;
-      ++string;
-    }
-    if(any_esc) {
-      // we will use an extra <span></span> to simplify logic
-
-      int span_end = has_esc * 7;
-
-      bytes_final = html_check_overflow(bytes_extra, bytes_init, span_end, i);
-
-      // Allocate target vector if it hasn't been yet
-
-      if(res == x) REPROTECT(res = duplicate(x), ipx);
+      int esc_start = state.pos.byte;
+      FANSI_read_next(&state);
 
-      // Allocate buffer and do second pass
+      // The text since the last ESC
 
-      FANSI_size_buff(&buff, bytes_final);
-      string = string_start;
-      state_start.warn = state.warn;
-      state = state_start;
+      const char * string_last = string_start + state_prev.pos.byte;
+      int bytes_prev = string - string_last;
+      if(!overflow && html_reserve(&buff, bytes_used, bytes_prev)) {
+        memcpy(buff.buff + bytes_used, string_last, bytes_prev);
+        bytes_used += bytes_prev;
+      } else overflow = 1;
 
-      // Rprintf("string is '%s'\n", state.string);
+      // If we have a change from the previous tag, write html/css
 
-      int first_esc = 1;
-      char * buff_track = buff.buff;
-
-      // Handle state left-over from previous char elem
-
-      if(FANSI_state_has_style_basic(state)) {
-        int bytes_html = state_as_html(state, first_esc, buff_track);
-        buff_track += bytes_html;
-        first_esc = 0;
+      if(FANSI_style_comp_basic(state.sgr, state_prev.sgr)) {
+        int cls = html_class(&cls_tbl, state.sgr);
+        bytes_extra =
+          html_compute_size(state, bytes_extra, esc_start, first_esc, cls, i);
+        if(
+          !overflow &&
+          html_reserve(
+            &buff, bytes_used, state_size_as_html(state, first_esc, cls)
+        ) )
+          bytes_used +=
+            state_as_html(state, first_esc, cls, buff.buff + bytes_used);
+        else overflow = 1;
+        if(first_esc) first_esc = 0;
       }
       state_prev = state;
+      string = state.string + state.pos.byte;
+    }
+    has_esc = !first_esc;
 
-      // Deal with state changes in this string
+    // we will use an extra <span></span> to simplify logic
 
-      while(*string && (string = strchr(string, 0x1b))) {
-        state.pos_byte = (string - string_start);
+    int span_end = has_esc * 7;
+    html_check_overflow(bytes_extra, bytes_init, span_end, i);
 
-        // read all sequential ESC tags
+    // Last hunk left to write and trailing SPAN
 
-        state = FANSI_read_next(state);
+    const char * string_last = state_prev.string + state_prev.pos.byte;
+    int bytes_stub = bytes_init - (string_last - string_start);
 
-        // The text since the last ESC
+    if(overflow || !html_reserve(&buff, bytes_used, bytes_stub + span_end))
+      // nocov start
+      error(
+        "%s%s",
+        "Internal Error: attempting to write string longer than INT_MAX; ",
+        "contact maintainer (4)."
+      );
+      // nocov end
+    memcpy(buff.buff + bytes_used, string_last, bytes_stub);
+    bytes_used += bytes_stub;
 
-        // Rprintf("prev_byte: %d\n", state_prev.pos_byte);
-        const char * string_last = string_start + state_prev.pos_byte;
-        int bytes_prev = string - string_last;
-        // Rprintf("bytes prev: %d\n", bytes_prev);
-        // Rprintf("write prev: '%.*s'\n", bytes_prev, string_last);
-        memcpy(buff_track, string_last, bytes_prev);
-        buff_track += bytes_prev;
+    if(has_esc) {
+      // Always close (I think, I'm writing this over a year after I wrote the
+      // code) tag.
 
-        // If we have a change from the previous tag, write html/css
+      /*--------------------------------------------------------------------*\
+      // WARNING: we're relying on this behavior to deal with the            |
+      // black friday business, see #59)                                     |
+      \*--------------------------------------------------------------------*/
 
-        if(FANSI_state_comp_basic(state, state_prev)) {
-          int bytes_html = state_as_html(state, first_esc, buff_track);
-          // Rprintf("write html: '%.*s'\n", bytes_html, buff_track);
-          buff_track += bytes_html;
-          if(first_esc) first_esc = 0;
-        }
-        state_prev = state;
-        string = state.string + state.pos_byte;
-      }
-      // Last hunk left to write and trailing SPAN
+      // Old comment: odd case where the only thing in the string is a null
+      // SGR (from looking at code this will always be require, so not sure
+      // what I mean by "odd case" as this is the only place we close tags
+      // without immediately reopening another).
 
-      const char * string_last = state_prev.string + state_prev.pos_byte;
-      int bytes_stub = bytes_init - (string_last - string_start);
-      // Rprintf("last: '%s'\n", string_last);
-      // Rprintf("stub %d string %d\n", bytes_stub, (string_last - string_start));
+      memcpy(buff.buff + bytes_used, "</span>", span_end);
+      bytes_used += span_end;
+    }
+    buff.buff[bytes_used] = 0;  // not strictly needed
 
-      memcpy(buff_track, string_last, bytes_stub);
-      buff_track += bytes_stub;
+    // Now create the charsxp what encoding to use.
 
-      if(has_esc) {
-        // Always close (I think, I'm writing this over a year after I wrote the
-        // code) tag.
+    if(bytes_used > (size_t) FANSI_int_max)
+      // nocov start
+      error(
+        "%s%s",
+        "Internal Error: attempting to write string longer than INT_MAX; ",
+        "contact maintainer (3)."
+      );
+      // nocov end
 
-        /*--------------------------------------------------------------------*\
-        // WARNING: we're relying on this behavior to deal with the            |
-        // black friday business, see #59)                                     |
-        \*--------------------------------------------------------------------*/
+    // Allocate target vector if it hasn't been yet
 
-        // Old comment: odd case where the only thing in the string is a null
-        // SGR (from looking at code this will always be require, so not sure
-        // what I mean by "odd case" as this is the only place we close tags
-        // without immediately reopening another).
+    if(res == x) REPROTECT(res = duplicate(x), ipx);
 
-        memcpy(buff_track, "</span>", span_end);
-        buff_track += span_end;
-      }
-      *(buff_track) = '0';  // not strictly needed
-
-      // Now create the charsxp what encoding to use.
-
-      if(buff_track - buff.buff > FANSI_int_max)
-        // nocov start
-        error(
-          "%s%s",
-          "Internal Error: attempting to write string longer than INT_MAX; ",
-          "contact maintainer (3)."
-        );
-        // nocov end
-
-      cetype_t chr_type = getCharCE(chrsxp);
-      SEXP chrsxp = PROTECT(
-        mkCharLenCE(buff.buff, (int) (buff_track - buff.buff), chr_type)
-      );
-      SET_STRING_ELT(res, i, chrsxp);
-      UNPROTECT(1);
-    }
+    cetype_t chr_type = getCharCE(chrsxp);
+    SEXP res_chr = PROTECT(mkCharLenCE(buff.buff, (int) bytes_used, chr_type));
+    SET_STRING_ELT(res, i, res_chr);
+    UNPROTECT(1);
+  }
+  if(cls_tbl.size) {
+    if(res == x) REPROTECT(res = duplicate(x), ipx);
+    SEXP style = PROTECT(html_classes_as_style(&cls_tbl));
+    setAttrib(res, FANSI_style_sym, style);
+    UNPROTECT(1);
   }
   UNPROTECT(1);
   return res;
@@ -539,8 +677,10 @@ SEXP FANSI_esc_to_html(SEXP x, SEXP warn, SEXP term_cap) {
 /*
  * Testing interface
  *
- * x is a 5 x N matrix where, for each column the first value is a color code,
- * and subsequent values correspond to the state.color_extra values.
+ * x is a 5 x N matrix where, for each column the first value is a color code
+ * (0-7, 8 for 256/true color, or 90-97 and 100-107 for bright colors), and
+ * subsequent values are the 256/true color specification, either (5, n, ., .)
+ * or (2, r, g, b).
  */
 
 SEXP FANSI_color_to_html_ext(SEXP x) {
@@ -559,7 +699,30 @@ SEXP FANSI_color_to_html_ext(SEXP x) {
   SEXP res = PROTECT(allocVector(STRSXP, len / 5));
 
   for(R_xlen_t i = 0; i < len; i += 5) {
-    int size = color_to_html(x_int[i], x_int + (i + 1), buff.buff);
+    int color = x_int[i];
+    int * color_extra = x_int + (i + 1);
+    uint32_t color_enc = 0;
+    if(color >= 0 && color < 8) {
+      color_enc = FANSI_CLR(FANSI_CLR_8, color);
+    } else if(color == 8 && color_extra[0] == 2) {
+      for(int j = 1; j < 4; ++j)
+        if(color_extra[j] < 0 || color_extra[j] > 255)
+          error("Invalid true color value."); // nocov
+      color_enc = FANSI_CLR(
+        FANSI_CLR_TRU,
+        color_extra[1] << 16 | color_extra[2] << 8 | color_extra[3]
+      );
+    } else if(color == 8 && color_extra[0] == 5) {
+      if(color_extra[1] < 0 || color_extra[1] > 255)
+        error("Invalid 256 color value."); // nocov
+      color_enc = FANSI_CLR(FANSI_CLR_256, color_extra[1]);
+    } else if(color >= 90 && color <= 97) {
+      color_enc = FANSI_CLR(FANSI_CLR_BRIGHT, color - 90);
+    } else if(color >= 100 && color <= 107) {
+      color_enc = FANSI_CLR(FANSI_CLR_BRIGHT, color - 100);
+    } else error("Internal Error: invalid color code %d", color); // nocov
+
+    int size = color_to_html(color_enc, buff.buff);
     if(size < 1) error("Internal Error: size should be at least one");
     SEXP chrsxp = PROTECT(mkCharLenCE(buff.buff, size, CE_BYTES));
     SET_STRING_ELT(res, i / 5, chrsxp);
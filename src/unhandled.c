@@ -63,13 +63,16 @@ SEXP FANSI_unhandled_esc(SEXP x, SEXP term_cap) {
       );
       int has_errors = 0;
 
-      while(state.string[state.pos_byte]) {
+      while(state.string[state.pos.byte]) {
         // Since we don't care about width, etc, we only use the state objects
-        // to parse the ESC sequences
+        // to parse the ESC sequences; plain ASCII can't be an error so we skip
+        // it in bulk
 
-        int esc_start = state.pos_ansi;
-        int esc_start_byte = state.pos_byte;
-        state = FANSI_read_next(state);
+        if(FANSI_read_ascii(&state, NULL, INT_MAX, 1)) continue;
+
+        int esc_start = state.pos.ansi;
+        int esc_start_byte = state.pos.byte;
+        FANSI_read_next(&state);
         if(state.err_code) {
           if(err_count == FANSI_int_max) {
             warning(
@@ -80,7 +83,7 @@ SEXP FANSI_unhandled_esc(SEXP x, SEXP term_cap) {
             break_early = 1;
             break;
           }
-          if(esc_start == INT_MAX || state.pos_ansi == INT_MAX)
+          if(esc_start == INT_MAX || state.pos.ansi == INT_MAX)
             // nocov start
             error(
               "%s%s",
@@ -93,13 +96,13 @@ SEXP FANSI_unhandled_esc(SEXP x, SEXP term_cap) {
           SEXP err_vals = PROTECT(allocVector(INTSXP, 7));
           INTEGER(err_vals)[0] = i + 1;
           INTEGER(err_vals)[1] = esc_start + 1;
-          INTEGER(err_vals)[2] = state.pos_ansi;
+          INTEGER(err_vals)[2] = state.pos.ansi;
           INTEGER(err_vals)[3] = state.err_code;
           INTEGER(err_vals)[4] = 0;
           // need actual bytes so we can substring the problematic sequence, so
           // we don't use 1 based indexing like with the earlier values
           INTEGER(err_vals)[5] = esc_start_byte;
-          INTEGER(err_vals)[6] = state.pos_byte - 1;
+          INTEGER(err_vals)[6] = state.pos.byte - 1;
           SEXP err_vals_list = PROTECT(list1(err_vals));
 
           if(!any_errors) {
@@ -16,7 +16,11 @@
  * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
  */
 
-#include "fansi.h"
+#ifdef FANSI_R_WIDTH
+#include "fansi.h"  // for R_nchar
+#else
+#include "parse.h"
+#endif
 /*
  * We need to translate to UTF8 any time that we care about string width as we
  * need to know how many bytes to select to feed through R_nchar.
@@ -39,123 +43,6 @@ int FANSI_has_utf8(const char * x) {
   }
   return 0;
 }
-// nocov start
-int FANSI_is_utf8_loc() {
-  error("Current not in use");
-  SEXP sys_getlocale = PROTECT(install("Sys.getlocale"));
-  SEXP lc_ctype = PROTECT(mkString("LC_CTYPE"));
-  SEXP loc_call = PROTECT(lang2(sys_getlocale, lc_ctype));
-
-  int err_val = 0;
-  SEXP eval_tmp = PROTECT(R_tryEval(loc_call, R_BaseEnv, &err_val));
-  if(err_val)
-    // nocov start
-    error("Internal Error: failed getting UTF8 locale; contact maintainer.");
-    // nocov end
-
-  if(TYPEOF(eval_tmp) != STRSXP && xlength(eval_tmp) != 1)
-    // nocov start
-    error("Internal Error: UTF8 locale not a string; contact maintainer.");
-    // nocov end
-
-  const char * loc_string = CHAR(asChar(eval_tmp));
-
-  // If eval_tmp produces a non-null terminated string we're screwed here...
-
-  size_t loc_len = strlen(loc_string);
-
-  if(loc_len > (size_t) FANSI_int_max)
-    // nocov start
-    error(
-      "%s%s",
-      "Internal Error: UTF8 locale string possibly longer than INT_MAX; ",
-      "contact maintainer."
-    );
-    // nocov end
-
-  int res = loc_len >= 5 &&
-    loc_string[loc_len - 1] == '8' &&
-    loc_string[loc_len - 2] == '-' &&
-    (loc_string[loc_len - 3] == 'F' || loc_string[loc_len - 3] == 'f') &&
-    (loc_string[loc_len - 4] == 'T' || loc_string[loc_len - 4] == 't') &&
-    (loc_string[loc_len - 5] == 'U' || loc_string[loc_len - 5] == 'u');
-
-  UNPROTECT(4);
-  return(res);
-}
-// nocov end
-
-/*
- * Translates a CHARSXP to a UTF8 char if necessary, otherwise returns
- * the char
- */
-// nocov start
-struct FANSI_string_as_utf8 FANSI_string_as_utf8(SEXP x) {
-  error("Currently not in use.");
-  if(TYPEOF(x) != CHARSXP)
-    error("Internal Error: expect CHARSXP."); // nocov
-
-  cetype_t enc_type = getCharCE(x);
-
-  if(enc_type == CE_BYTES)
-    error("BYTE encoded strings are not supported.");
-
-  // CE_BYTES is not necessarily of any encoding, don't allow then?
-
-  int translate = enc_type != CE_UTF8;
-  const char * string;
-  int len = 0;
-  int translated = 0;
-  if(translate) {
-    // would be nice to know if `x` is ASCII only, but at least translate will
-    // just return string if that's what it is
-    string = translateCharUTF8(x);
-    if(string == CHAR(x)) len = LENGTH(x);
-    else {
-      translated = 1;
-      len = strlen(string);
-    }
-  } else {
-    string = CHAR(x);
-    len = strlen(string);
-  }
-  return (struct FANSI_string_as_utf8) {
-    .string=string, .len=len, .translated=translated
-  };
-}
-// nocov end
-
-/*
- * Confirm encoding is not obviously wrong
- */
-
-void FANSI_check_enc(SEXP x, R_xlen_t i) {
-  cetype_t type = getCharCE(x);
-  if(type != CE_NATIVE && type != CE_UTF8) {
-    if(type == CE_BYTES)
-      error(
-        "%s at index %.0f. %s.",
-        "Byte encoded string encountered", (double) i + 1,
-        "Byte encoded strings are not supported"
-      );
-    else
-      // this should only happen if somehow a string not converted to UTF8
-      // sneaks in.
-      error(
-        "%s %d encountered at index %.0f. %s.",
-        "Internal Error: unexpected encoding", type,
-        (double) i + 1, "Contact maintainer"
-      );
-  }
-}
-/*
- * Testing interface
- */
-SEXP FANSI_check_enc_ext(SEXP x, SEXP i) {
-  FANSI_check_enc(STRING_ELT(x, asInteger(i) - 1), asInteger(i) - 1);
-  return ScalarLogical(1);
-}
-
 /*
  * Code copied directly from src/main/util.c@1186, this code is actually not
  * completely compliant, but we're just trying to match R behavior rather than
@@ -181,3 +68,122 @@ int FANSI_utf8clen(char c)
 }
 
 
+/*
+ * Decode the UTF-8 sequence starting at `*p`, which must be a non-ASCII byte,
+ * and advance `*p` past it.
+ *
+ * Validation mirrors `valid_utf8` from R's src/main/util.c.
+ *
+ * @return the code point, or -1 if the sequence is not valid.
+ */
+static int utf8_decode(const unsigned char ** pp, const unsigned char * end) {
+  const unsigned char * p = *pp;
+  unsigned int c = *p;
+
+  if(c < 0xc0 || c >= 0xf5) return -1;
+  int ab = utf8_table4[c & 0x3f];
+  if(end - p <= ab) return -1;
+  unsigned int d = p[1];
+  if((d & 0xc0) != 0x80) return -1;
+
+  int cp;
+  switch(ab) {
+    case 1:
+      if((c & 0x3e) == 0) return -1;
+      cp = ((c & 0x1f) << 6) | (d & 0x3f);
+      break;
+    case 2:
+      if((p[2] & 0xc0) != 0x80) return -1;
+      if(c == 0xe0 && (d & 0x20) == 0) return -1;
+      if(c == 0xed && d >= 0xa0) return -1;
+      cp = ((c & 0x0f) << 12) | ((d & 0x3f) << 6) | (p[2] & 0x3f);
+      break;
+    case 3:
+      if((p[2] & 0xc0) != 0x80 || (p[3] & 0xc0) != 0x80) return -1;
+      if(c == 0xf0 && (d & 0x30) == 0) return -1;
+      if(c == 0xf4 && d > 0x8f) return -1;
+      cp = ((c & 0x07) << 18) | ((d & 0x3f) << 12) | ((p[2] & 0x3f) << 6) |
+        (p[3] & 0x3f);
+      break;
+    default:
+      return -1;  // 5 and 6 byte sequences are no longer valid
+  }
+  *pp = p + ab + 1;
+  return cp;
+}
+/*
+ * Count the characters in `bytes` bytes of a UTF-8 string
+ *
+ * @return the count, or FANSI_NA_INT if the sequence is not valid UTF-8.
+ */
+int FANSI_utf8_chars(const char * x, int bytes) {
+  const unsigned char * p = (const unsigned char *) x;
+  const unsigned char * end = p + bytes;
+  int chars = 0;
+
+  while(p < end) {
+    if(*p < 0x80) ++p;
+    else if(utf8_decode(&p, end) < 0) return FANSI_NA_INT;
+    ++chars;
+  }
+  return chars;
+}
+/*
+ * Display width of a UTF-8 code point, see extra/width.py for how the table is
+ * generated.
+ */
+#ifndef FANSI_R_WIDTH
+#include "width.h"
+
+static int cp_width(int cp) {
+  if(cp < FANSI_WIDTH_MIN) return 1;
+
+  int lo = 0, hi = FANSI_WIDTH_RANGES - 1;
+  if(cp > FANSI_width_table[hi].hi) return 1;
+  while(lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    if(cp > FANSI_width_table[mid].hi) lo = mid + 1;
+    else if(cp < FANSI_width_table[mid].lo) hi = mid - 1;
+    else return FANSI_width_table[mid].width;
+  }
+  return 1;
+}
+#endif
+/*
+ * Compute display width of `bytes` bytes of a UTF-8 string
+ *
+ * Intended to match `R_nchar(..., type=Width, allowNA=TRUE)` on the same bytes,
+ * without having to create a CHARSXP for them, so in particular returns
+ * FANSI_NA_INT (i.e. NA_INTEGER) if the sequence is not valid UTF-8 as per R's
+ * `valid_utf8`.  ASCII bytes, including C0 controls, are one wide.
+ *
+ * Compile with -DFANSI_R_WIDTH to use `R_nchar` directly so that results are
+ * bit-compatible with R's `Ri18n_wcwidth` (which can vary with locale and R
+ * version), at a substantial performance cost.
+ */
+int FANSI_utf8_width(const char * x, int bytes) {
+#ifdef FANSI_R_WIDTH
+  SEXP str_chr = PROTECT(mkCharLenCE(x, bytes, CE_UTF8));
+  int res = R_nchar(
+    str_chr, Width, TRUE, FALSE, "when computing display width"
+  );
+  UNPROTECT(1);
+  return res;
+#else
+  const unsigned char * p = (const unsigned char *) x;
+  const unsigned char * end = p + bytes;
+  int width = 0;
+
+  while(p < end) {
+    if(*p < 0x80) {
+      ++width;
+      ++p;
+      continue;
+    }
+    int cp = utf8_decode(&p, end);
+    if(cp < 0) return FANSI_NA_INT;
+    width += cp_width(cp);
+  }
+  return width;
+#endif
+}
@@ -16,7 +16,10 @@
  * Go to <https://www.r-project.org/Licenses/GPL-2> for a copy of the license.
  */
 
+#include <stdarg.h>
+#include <stdio.h>
 #include "fansi.h"
+
 /*
  * Used to set a global int_max value smaller than INT_MAX for testing
  * purposes
@@ -27,6 +30,27 @@
  */
 int FANSI_int_max = INT_MAX;
 int FANSI_int_min = INT_MIN;  // no way to change this externally
+/*
+ * Errors and warnings from the parser, see parse.h
+ *
+ * R truncates messages to 8192 bytes so we do too.
+ */
+void FANSI_error(const char * fmt, ...) {
+  char msg[8192];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  error("%s", msg);
+}
+void FANSI_warning(const char * fmt, ...) {
+  char msg[8192];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  warning("%s", msg);
+}
 
 SEXP FANSI_set_int_max(SEXP x) {
   if(TYPEOF(x) != INTSXP || XLENGTH(x) != 1)
@@ -71,135 +95,6 @@ SEXP FANSI_add_int_ext(SEXP x, SEXP y) {
 
   return ScalarInteger(FANSI_ADD_INT(asInteger(x), asInteger(y)));
 }
-/*
- * Compute Location and Size of Next ANSI Sequences
- *
- * See FANSI_parse_esc as well, where there is similar logic, although we keep
- * it separated here for speed since we don't try to interpret the string.
- *
- * Length includes the ESC and [, and start point is the ESC.
- *
- * Validity here means striclty that all the contained escape sequences were
- * valid CSI sequences as per the strict definition.
- *
- * We report the length of invalid sequnces, but you really can't trust them.
- * The true length may actually be different depending on your terminal,
- * (e.g. OSX terminal spits out illegal characters to screen but keeps
- * processing the sequence).
- *
- * @param ctl is a bit flag to line up against VALID.WHAT index values, so
- *   (ctl & (1 << 0)) is newlines, (ctl & (1 << 1)) is C0, etc, though note
- *   this does not act
- */
-
-struct FANSI_csi_pos FANSI_find_esc(const char * x, int ctl) {
-  /***************************************************\
-  | IMPORTANT: KEEP THIS ALIGNED WITH FANSI_read_esc  |
-  | although now this also deals with c0              |
-  \***************************************************/
-  int valid = 1;
-  int found = 0;
-  int found_ctl = 0;
-  const char * x_track = x;
-  const char * x_found_start;
-  const char * x_found_end;
-
-  struct FANSI_csi_pos res;
-
-  while(*x_track) {
-    const char x_val = *(x_track++);
-    // use found & found_this in conjunction so that we can allow multiple
-    // adjacent elements to be found in one go
-
-    int found_this = 0;
-
-    // If not normal ASCII or UTF8, examine whether we need to found
-    if(!((x_val > 31 && x_val < 127) || x_val < 0 || x_val > 127)) {
-      if(!found) {
-        // Keep resetting strip start point until we find something we want to
-        // mark
-        x_found_start = x_found_end = x_track - 1;
-      }
-      found_this = 0;
-      if(x_val == 27) {
-        if(*x_track == '[') {
-          // This is a CSI sequence, so it has multiple characters that we
-          // need to skip.  The final character is processed outside of here
-          // since it has the same logic for CSI and non CSI sequences
-
-          // skip [
-
-          ++x_track;
-
-          // Skip all the valid parameters tokens
-
-          while(*x_track >= 0x30 && *x_track <= 0x3F) ++x_track;
-
-          // And all the valid intermediates
-
-          int intermediate = 0;
-          while(*x_track >= 0x20 && *x_track <= 0x2F) {
-            if(!intermediate) intermediate = 1;
-            ++x_track;
-          }
-          // Check validity
-
-          int valid_tmp = *x_track >= 0x40 && *x_track <= 0x7E;
-
-          // If not valid, consume all subsequent parameter tokens  as that
-          // seems to be terminal.osx and iterm behavior (though terminal.osx
-          // seems pretty picky about what it considers intermediate or even
-          // parameter characters).
-
-          if(!valid_tmp)
-            while(*x_track >= 0x20 && *x_track <= 0x3F) ++x_track;
-
-          valid = valid && valid_tmp;
-
-          // CSI SGR only found if ends in m and no intermediate
-
-          int sgr = !intermediate && *x_track == 'm';
-          found_ctl |= sgr ? FANSI_CTL_SGR & ctl : FANSI_CTL_CSI & ctl;
-          found_this =
-            (sgr && (ctl & FANSI_CTL_SGR)) ||  // SGR
-            (!sgr && (ctl & FANSI_CTL_CSI));      // CSI
-        } else {
-          // Includes both the C1 set and "controls strings"
-          found_this = ctl & FANSI_CTL_ESC;
-          found_ctl |= ctl & FANSI_CTL_ESC;
-          valid = valid && (*x_track >= 0x40 && *x_track <= 0x7E);
-        }
-        // Advance unless next char is ESC, in which case we want to keep
-        // looping
-
-        if(*x_track && *x_track != 27) x_track++;
-      } else {
-        // x01-x1F, x7F, all the C0 codes
-
-        found_ctl |= (x_val == '\n' ? ctl & FANSI_CTL_NL : ctl & FANSI_CTL_C0);
-        found_this =
-          (x_val == '\n' && (ctl & FANSI_CTL_NL)) ||
-          (x_val != '\n' && (ctl & FANSI_CTL_C0));
-      }
-      if(found_this) {
-        x_found_end = x_track;
-        if(!found) found = 1;
-      }
-    }
-    if(found && !found_this) break;
-  }
-  if(found) {
-    res = (struct FANSI_csi_pos){
-      .start=x_found_start, .len=(x_found_end - x_found_start),
-      .valid=valid, .ctl=found_ctl
-    };
-  } else {
-    res = (struct FANSI_csi_pos){
-      .start=x, .len=0, .valid=valid, ctl=found_ctl
-    };
-  }
-  return res;
-}
 /*
  * Allocates a fresh chunk of memory if the existing one is not large enough.
  *
@@ -253,19 +148,20 @@ void FANSI_size_buff(struct FANSI_buff * buff, size_t size) {
   }
 }
 /*
- * Compute how many digits are in a number
+ * Like `FANSI_size_buff`, but preserves the first `used` bytes of the buffer
+ * contents when it has to grow.
  *
- * Add an extra character for negative integers.
+ * Since `FANSI_size_buff` at least doubles the buffer, this can be used to
+ * append to a buffer incrementally in amortized linear time.
  */
-
-int FANSI_digits_in_int(int x) {
-  int num = 1;
-  if(x < 0) {
-    ++num;
-    x = -x;
+void FANSI_grow_buff(struct FANSI_buff * buff, size_t used, size_t size) {
+  if(size > buff->len) {
+    const char * old = buff->buff;
+    if(used > buff->len)
+      error("Internal Error: used more than buffer size.");  // nocov
+    FANSI_size_buff(buff, size);
+    if(used) memcpy(buff->buff, old, used);
   }
-  while((x = (x / 10))) ++num;
-  return num;
 }
 SEXP FANSI_digits_in_int_ext(SEXP y) {
   if(TYPEOF(y) != INTSXP) error("Internal Error: required int.");
@@ -354,79 +250,6 @@ int FANSI_pmatch(
 // concept borrowed from utf8-lite
 
 void FANSI_interrupt(int i) {if(!(i % 1000)) R_CheckUserInterrupt();}
-/*
- * Split an integer vector into two equal size pieces
- */
-
-SEXP FANSI_cleave(SEXP x) {
-  if(TYPEOF(x) != INTSXP || XLENGTH(x) % 2)
-    error("Internal error, need even length INTSXP.");  // nocov
-
-  R_xlen_t len = XLENGTH(x) / 2;
-  if((size_t) len > SIZE_MAX)
-    error("Internal error: vector too long to cleave"); // nocov
-
-  SEXP a, b;
-  a = PROTECT(allocVector(INTSXP, len));
-  b = PROTECT(allocVector(INTSXP, len));
-
-  size_t size = 0;
-  for(int i = 0; i < (int) sizeof(int); ++i) {
-    if(size > SIZE_MAX - len)
-      error("Internal error: vector too long to cleave"); // nocov
-    size += len;
-  }
-  memcpy(INTEGER(a), INTEGER(x), size);
-  memcpy(INTEGER(b), INTEGER(x) + len, size);
-
-  SEXP res = PROTECT(allocVector(VECSXP, 2));
-  SET_VECTOR_ELT(res, 0, a);
-  SET_VECTOR_ELT(res, 1, b);
-  UNPROTECT(3);
-  return res;
-}
-struct datum {int val; R_xlen_t idx;};
-
-static int cmpfun (const void * p, const void * q) {
-  struct datum a = *(struct datum *) p;
-  struct datum b = *(struct datum *) q;
-  return(a.val > b.val ? 1 : (a.val < b.val ? -1 : 0));
-}
-/*
- * Equivalent to `order`, but less overhead.  May not be faster for longer
- * vectors but since we call it potentially repeatedly via our initial version
- * of strsplit, we want to do this to make somewhat less sub-optimal
- */
-SEXP FANSI_order(SEXP x) {
-  if(TYPEOF(x) != INTSXP)
-    error("Internal error: this order only supports ints.");  // nocov
-
-  R_xlen_t len = XLENGTH(x);
-  SEXP res;
-
-  if(len) {
-    size_t size = 0;
-    for(int i = 0; i < (int) sizeof(struct datum); ++i) {
-      if(size > SIZE_MAX - len)
-        error("Internal error: vector too long to order"); // nocov
-      size += len;
-    }
-    struct datum * data = (struct datum *) R_alloc(len, sizeof(struct datum));
-
-    for(R_xlen_t i = 0; i < len; ++i)
-      *(data + i) = (struct datum){.val=INTEGER(x)[i], .idx=i + 1};
-
-    qsort(data, (size_t) len, sizeof(struct datum), cmpfun);
-
-    res = PROTECT(allocVector(INTSXP, len));
-
-    for(R_xlen_t i = 0; i < len; ++i) INTEGER(res)[i] = (data + i)->idx;
-  } else {
-    res = PROTECT(allocVector(INTSXP, 0));
-  }
-  UNPROTECT(1);
-  return res;
-}
 /*
  * Equivalent to `sort`, but less overhead.  May not be faster for longer
  * vectors but since we call it potentially repeatedly via our initial version
@@ -467,8 +290,6 @@ static int cmpfun3 (const void * p, const void * q) {
  *
  * Beware, the sort is not lexical, instead this is sorted by the memory addess
  * of the character strings backing each CHARSXP.
- *
- * The only purpose of this is to support the unique_chr function.
  */
 
 SEXP FANSI_sort_chr(SEXP x) {
@@ -483,7 +304,7 @@ SEXP FANSI_sort_chr(SEXP x) {
     // size_t
 
     size_t size = 0;
-    for(int i = 0; i < (int) sizeof(struct datum); ++i) {
+    for(int i = 0; i < (int) sizeof(struct datum2); ++i) {
       if(size > SIZE_MAX - len)
         error("Internal error: vector too long to order"); // nocov
       size += len;
@@ -504,3 +325,119 @@ SEXP FANSI_sort_chr(SEXP x) {
   }
   return res;
 }
+// nocov start
+int FANSI_is_utf8_loc() {
+  error("Current not in use");
+  SEXP sys_getlocale = PROTECT(install("Sys.getlocale"));
+  SEXP lc_ctype = PROTECT(mkString("LC_CTYPE"));
+  SEXP loc_call = PROTECT(lang2(sys_getlocale, lc_ctype));
+
+  int err_val = 0;
+  SEXP eval_tmp = PROTECT(R_tryEval(loc_call, R_BaseEnv, &err_val));
+  if(err_val)
+    // nocov start
+    error("Internal Error: failed getting UTF8 locale; contact maintainer.");
+    // nocov end
+
+  if(TYPEOF(eval_tmp) != STRSXP && xlength(eval_tmp) != 1)
+    // nocov start
+    error("Internal Error: UTF8 locale not a string; contact maintainer.");
+    // nocov end
+
+  const char * loc_string = CHAR(asChar(eval_tmp));
+
+  // If eval_tmp produces a non-null terminated string we're screwed here...
+
+  size_t loc_len = strlen(loc_string);
+
+  if(loc_len > (size_t) FANSI_int_max)
+    // nocov start
+    error(
+      "%s%s",
+      "Internal Error: UTF8 locale string possibly longer than INT_MAX; ",
+      "contact maintainer."
+    );
+    // nocov end
+
+  int res = loc_len >= 5 &&
+    loc_string[loc_len - 1] == '8' &&
+    loc_string[loc_len - 2] == '-' &&
+    (loc_string[loc_len - 3] == 'F' || loc_string[loc_len - 3] == 'f') &&
+    (loc_string[loc_len - 4] == 'T' || loc_string[loc_len - 4] == 't') &&
+    (loc_string[loc_len - 5] == 'U' || loc_string[loc_len - 5] == 'u');
+
+  UNPROTECT(4);
+  return(res);
+}
+// nocov end
+
+/*
+ * Translates a CHARSXP to a UTF8 char if necessary, otherwise returns
+ * the char
+ */
+// nocov start
+struct FANSI_string_as_utf8 FANSI_string_as_utf8(SEXP x) {
+  error("Currently not in use.");
+  if(TYPEOF(x) != CHARSXP)
+    error("Internal Error: expect CHARSXP."); // nocov
+
+  cetype_t enc_type = getCharCE(x);
+
+  if(enc_type == CE_BYTES)
+    error("BYTE encoded strings are not supported.");
+
+  // CE_BYTES is not necessarily of any encoding, don't allow then?
+
+  int translate = enc_type != CE_UTF8;
+  const char * string;
+  int len = 0;
+  int translated = 0;
+  if(translate) {
+    // would be nice to know if `x` is ASCII only, but at least translate will
+    // just return string if that's what it is
+    string = translateCharUTF8(x);
+    if(string == CHAR(x)) len = LENGTH(x);
+    else {
+      translated = 1;
+      len = strlen(string);
+    }
+  } else {
+    string = CHAR(x);
+    len = strlen(string);
+  }
+  return (struct FANSI_string_as_utf8) {
+    .string=string, .len=len, .translated=translated
+  };
+}
+// nocov end
+
+/*
+ * Confirm encoding is not obviously wrong
+ */
+
+void FANSI_check_enc(SEXP x, R_xlen_t i) {
+  cetype_t type = getCharCE(x);
+  if(type != CE_NATIVE && type != CE_UTF8) {
+    if(type == CE_BYTES)
+      error(
+        "%s at index %.0f. %s.",
+        "Byte encoded string encountered", (double) i + 1,
+        "Byte encoded strings are not supported"
+      );
+    else
+      // this should only happen if somehow a string not converted to UTF8
+      // sneaks in.
+      error(
+        "%s %d encountered at index %.0f. %s.",
+        "Internal Error: unexpected encoding", type,
+        (double) i + 1, "Contact maintainer"
+      );
+  }
+}
+/*
+ * Testing interface
+ */
+SEXP FANSI_check_enc_ext(SEXP x, SEXP i) {
+  FANSI_check_enc(STRING_ELT(x, asInteger(i) - 1), asInteger(i) - 1);
+  return ScalarLogical(1);
+}
@@ -25,7 +25,7 @@
  */
 struct FANSI_prefix_dat {
   const char * string;  // string translated to utf8
-  int width;            // display width as computed by R_nchar
+  int width;            // display width as computed by FANSI_utf8_width
   int bytes;            // bytes, excluding NULL terminator
   // how many indent/exdent bytes are included in string, width, and bytes
   int indent;
@@ -48,11 +48,8 @@ static struct FANSI_prefix_dat make_pre(SEXP x) {
   SEXP warn = PROTECT(ScalarInteger(2));
   SEXP ctl = PROTECT(ScalarInteger(1));
   SEXP x_strip = PROTECT(FANSI_strip(x, ctl, warn));
-  int x_width = R_nchar(
-    asChar(x_strip), Width, TRUE, FALSE, "when computing display width"
-  );
-  // wish we could get this directly from R_nchar, grr
-
+  SEXP x_strip_chr = asChar(x_strip);
+  int x_width = FANSI_utf8_width(CHAR(x_strip_chr), LENGTH(x_strip_chr));
   int x_bytes = strlen(x_utf8);
   int warn_int = getAttrib(x_strip, FANSI_warn_sym) != R_NilValue;
 
@@ -131,15 +128,15 @@ SEXP FANSI_writeline(
   // Check if we are in a CSI state b/c if we are we neeed extra room for
   // the closing state tag
 
-  int needs_close = FANSI_state_has_style(state_bound);
-  int needs_start = FANSI_state_has_style(state_start);
+  int needs_close = FANSI_style_has(state_bound.sgr);
+  int needs_start = FANSI_style_has(state_start.sgr);
 
-  // state_bound.pos_byte 1 past what we need, so this should include room
+  // state_bound.pos.byte 1 past what we need, so this should include room
   // for NULL terminator
 
   if(
-    (state_bound.pos_byte < state_start.pos_byte) ||
-    (state_bound.pos_width < state_start.pos_width)
+    (state_bound.pos.byte < state_start.pos.byte) ||
+    (state_bound.pos.width < state_start.pos.width)
   )
     // nocov start
     error("Internal Error: boundary leading position; contact maintainer.");
@@ -147,8 +144,8 @@ SEXP FANSI_writeline(
 
   if(tar_width < 0) tar_width = 0;
 
-  size_t target_size = state_bound.pos_byte - state_start.pos_byte;
-  size_t target_width = state_bound.pos_width - state_start.pos_width;
+  size_t target_size = state_bound.pos.byte - state_start.pos.byte;
+  size_t target_width = state_bound.pos.width - state_start.pos.width;
   int target_pad = 0;
 
   if(!target_size) {
@@ -193,7 +190,7 @@ SEXP FANSI_writeline(
 
   if(needs_close) start_close += 4;
   if(needs_start) {
-    state_start_size = FANSI_state_size(state_start);
+    state_start_size = FANSI_style_size(state_start.sgr);
     start_close += state_start_size;  // this can't possibly overflow
   }
   if(target_size > (size_t)(FANSI_int_max - start_close)) {
@@ -215,7 +212,7 @@ SEXP FANSI_writeline(
 
   if(needs_start) {
     // Rprintf("  writing start: %d\n", state_start_size);
-    FANSI_csi_write(buff_track, state_start, state_start_size);
+    FANSI_csi_write(buff_track, state_start.sgr, state_start_size);
     buff_track += state_start_size;
   }
   // Apply indent/exdent prefix/initial
@@ -225,14 +222,14 @@ SEXP FANSI_writeline(
     memcpy(buff_track, pre_dat.string, pre_dat.bytes);
     buff_track += pre_dat.bytes;
   }
-  // Actual string, remember state_bound.pos_byte is one past what we need
+  // Actual string, remember state_bound.pos.byte is one past what we need
   // (but what if we're in strip.space=FALSE?)
 
   memcpy(
-    buff_track, state_start.string + state_start.pos_byte,
-    state_bound.pos_byte - state_start.pos_byte
+    buff_track, state_start.string + state_start.pos.byte,
+    state_bound.pos.byte - state_start.pos.byte
   );
-  buff_track += state_bound.pos_byte - state_start.pos_byte;
+  buff_track += state_bound.pos.byte - state_start.pos.byte;
 
   // Add padding if needed
 
@@ -250,7 +247,7 @@ SEXP FANSI_writeline(
   // Rprintf("written %d\n", buff_track - (buff->buff) + 1);
 
   // Now create the charsxp and append to the list, start by determining
-  // what encoding to use.  If pos_byte is greater than pos_ansi it means
+  // what encoding to use.  If pos.byte is greater than pos.ansi it means
   // we must have hit a UTF8 encoded character
 
   cetype_t chr_type = CE_NATIVE;
@@ -272,56 +269,81 @@ SEXP FANSI_writeline(
   return res_sxp;
 }
 /*
- * All input strings are expected to be in UTF8 compatible format (i.e. either
- * encoded in UTF8, or contain only bytes in 0-127).  That way we know we can
- * set the encoding to UTF8 if there are any bytes greater than 127, or NATIVE
- * otherwise under the assumption that 0-127 is valid in all encodings.
+ * Wrapping happens in two steps: first we find where each line starts and
+ * ends along with the SGR state at those points, and then we write the lines
+ * out.  The first step does not use the R API (other than for warnings, which
+ * can be deferred, see FANSI_WARN_DEFER), so it may be run off of the main
+ * thread.
  *
- * @param buff a pointer to a buffer struct.  We use pointer to a
- *   pointer because it may need to be resized, but we also don't want to
- *   re-allocate the buffer between calls.
- * @param pre_first, pre_next, strings (and associated meta data) to prepend to
- *   each line; pre_first can be based of of `prefix` or off of `initial`
- *   depending whether we're at the very first line of the external input or not
- * @param strict whether to hard wrap at width or not (not is what strwrap does
- *   by default)
+ * `wrap_line` records the parts of the start and boundary states that
+ * FANSI_writeline needs.
+ */
+struct wrap_line {
+  struct FANSI_style sgr_start, sgr_bound;
+  int byte_start, byte_bound;
+  int width_start, width_bound;
+  int has_utf8;     // in the string up to the boundary
+  int para_start;   // whether the line starts a paragraph
+};
+/*
+ * Lines found for an element.  If `grow` is TRUE `lines` is grown with
+ * `R_alloc` as needed, otherwise we stop when we run out of space.  `warned`
+ * records whether reading the element issued (or deferred) a warning.
  */
+struct wrap_lines {
+  struct wrap_line * lines;
+  R_xlen_t len, size;
+  int grow;
+  int warned;
+};
+#define WRAP_OK 0
+#define WRAP_NARROW 1   // width narrower than a character in wrap.always mode
+#define WRAP_FULL 2     // `lines` is full and can't grow
 
-static SEXP strwrap(
-  const char * x, int width,
-  struct FANSI_prefix_dat pre_first,
-  struct FANSI_prefix_dat pre_next,
-  int wrap_always,
-  struct FANSI_buff * buff,
-  const char * pad_chr,
-  int strip_spaces,
-  SEXP warn, SEXP term_cap,
-  int first_only, SEXP ctl
+static int wrap_add_line(
+  struct wrap_lines * lines, struct FANSI_state * bound,
+  struct FANSI_state * start, int para_start
+) {
+  if(lines->len >= lines->size) {
+    if(!lines->grow) return WRAP_FULL;
+    if(lines->size > R_XLEN_T_MAX / 2)
+      error("Internal Error: too many wrapped lines.");  // nocov
+    R_xlen_t size_new = lines->size ? lines->size * 2 : 64;
+    struct wrap_line * lines_new =
+      (struct wrap_line *) R_alloc(size_new, sizeof(struct wrap_line));
+    if(lines->len)
+      memcpy(lines_new, lines->lines, lines->len * sizeof(struct wrap_line));
+    lines->lines = lines_new;
+    lines->size = size_new;
+  }
+  lines->lines[lines->len++] = (struct wrap_line) {
+    .sgr_start=start->sgr, .sgr_bound=bound->sgr,
+    .byte_start=start->pos.byte, .byte_bound=bound->pos.byte,
+    .width_start=start->pos.width, .width_bound=bound->pos.width,
+    .has_utf8=bound->has_utf8, .para_start=para_start
+  };
+  return WRAP_OK;
+}
+/*
+ * Find the lines that a string wraps into
+ *
+ * @param state the initial state, with `string` set to the string to wrap.  On
+ *   return it is the state where we stopped reading, which is the end of the
+ *   string unless we returned early.
+ * @param width_1, width_2 width available for the first line of a paragraph
+ *   and for the others respectively once the prefixes are accounted for.
+ * @param lines where to record the lines.
+ * @return one of the WRAP_* codes.  The lines found before we stopped are
+ *   recorded in all cases.
+ */
+static int wrap_find(
+  struct FANSI_state * state_end,
+  int width_1, int width_2,
+  int wrap_always, int strip_spaces, int first_only,
+  struct wrap_lines * lines
 ) {
-  SEXP R_true = PROTECT(ScalarLogical(1));
-  SEXP R_one = PROTECT(ScalarInteger(1));
-  struct FANSI_state state = FANSI_state_init_full(
-    x, warn, term_cap, R_true, R_true, R_one, ctl
-  );
-  UNPROTECT(2);
-
-  int width_1 = FANSI_ADD_INT(width, -pre_first.width);
-  int width_2 = FANSI_ADD_INT(width, -pre_next.width);
-
   int width_tar = width_1;
 
-  if(width < 1 && wrap_always)
-    error("Internal Error: invalid width."); // nocov
-  if(wrap_always && (width_1 < 0 || width_2 < 0))
-    error("Internal Error: incompatible width/indent/prefix."); // nocov
-
-  // Use LISTSXP so we don't have to do a two pass process to determine how many
-  // items we're going to have, unless we're in first only in which case we know
-  // we only need one element per and don't actually use these
-
-  SEXP char_list_start, char_list;
-  char_list_start = char_list = PROTECT(list1(R_NilValue));
-
   int prev_boundary = 0;    // tracks if previous char was a boundary
   int has_boundary = 0;     // tracks if at least one boundary in a line
   int para_start = 1;
@@ -332,27 +354,38 @@ static SEXP strwrap(
 
   int first_line = 1;
   int last_start = 0;
+  int status = WRAP_OK;
 
   // Need to keep track of where word boundaries start and end due to
   // possibility for multiple elements between words
 
-  struct FANSI_state state_start, state_bound, state_prev;
-  state_start = state_bound = state_prev = state;
-  R_xlen_t size = 0;
-  SEXP res_sxp;
+  struct FANSI_state state_start, state_bound;
+
+  // The current, next, and previous states rotate through three slots so that
+  // we don't have to copy the state struct around for every character.
+
+  struct FANSI_state state_slots[3];
+  struct FANSI_state * state = state_slots;
+  struct FANSI_state * state_next = state_slots + 1;
+  struct FANSI_state * state_prev = state_slots + 2;
+  state_start = state_bound = *state = *state_prev = *state_end;
 
   while(1) {
-    struct FANSI_state state_next;
+    // Runs of printable ASCII other than spaces cannot be boundaries, so as
+    // long as they keep us short of the target width we can read them in bulk
+
+    if(
+      width_tar > state->pos.width &&
+      FANSI_read_ascii(state, state_prev, width_tar - state->pos.width, 0)
+    )
+      prev_boundary = 0;
 
     // Can no longer advance after we reach end, but we still need to assemble
     // strings so we assign `state` even though technically not correct
 
-    if(!state.string[state.pos_byte]){
-      state_next = state;
-    } else {
-      state_next = FANSI_read_next(state);
-    }
-    state.warn = state_bound.warn = state_next.warn;  // avoid double warning
+    *state_next = *state;
+    if(state->string[state->pos.byte]) FANSI_read_next(state_next);
+    state->warn = state_bound.warn = state_next->warn;  // avoid double warning
 
     // detect word boundaries and paragraph starts; we need to track
     // state_bound for the special case where we are in strip space mode
@@ -360,17 +393,12 @@ static SEXP strwrap(
     // get after [.!?].
 
     if(
-      state.string[state.pos_byte] == ' ' ||
-      state.string[state.pos_byte] == '\t' ||
-      state.string[state.pos_byte] == '\n'
+      state->string[state->pos.byte] == ' ' ||
+      state->string[state->pos.byte] == '\t' ||
+      state->string[state->pos.byte] == '\n'
     ) {
-      // Rprintf(
-      //   "Bound @ %d raw: %d chr: %d prev: %d\n",
-      //   state.pos_byte - state_start.pos_byte, state.pos_byte,
-      //   state.string[state.pos_byte], prev_boundary
-      // );
-      if(strip_spaces && !prev_boundary) state_bound = state;
-      else if(!strip_spaces) state_bound = state;
+      if(strip_spaces && !prev_boundary) state_bound = *state;
+      else if(!strip_spaces) state_bound = *state;
       has_boundary = prev_boundary = 1;
     } else {
       prev_boundary = 0;
@@ -378,75 +406,60 @@ static SEXP strwrap(
     // Write the line
 
     if(
-      !state.string[state.pos_byte] ||
+      !state->string[state->pos.byte] ||
       // newlines kept in strtrim mode
-      (state.string[state.pos_byte] == '\n' && !first_only) ||
+      (state->string[state->pos.byte] == '\n' && !first_only) ||
       (
         (
-          state.pos_width > width_tar ||
+          state->pos.width > width_tar ||
           (
             // If exactly at width we need to keep going if the next char is
             // zero width, otherwise we should write the string
-            state.pos_width == width_tar &&
-            state_next.pos_width > state.pos_width
+            state->pos.width == width_tar &&
+            state_next->pos.width > state->pos.width
         ) ) &&
         (has_boundary || wrap_always)
       )
     ) {
       if(
-        !state.string[state.pos_byte] ||
+        !state->string[state->pos.byte] ||
         (wrap_always && !has_boundary) || first_only
       ) {
-        if(state.pos_width > width_tar && wrap_always) {
-          state = state_prev; // wide char overshoot
+        if(state->pos.width > width_tar && wrap_always) {
+          *state = *state_prev; // wide char overshoot
         }
-        state_bound = state;
+        state_bound = *state;
       }
-      if(!first_line && last_start >= state_start.pos_byte) {
-        error(
-          "%s%s",
-          "Wrap error: trying to wrap to width narrower than ",
-          "character width; set `wrap.always=FALSE` to resolve."
-        );
+      if(!first_line && last_start >= state_start.pos.byte) {
+        status = WRAP_NARROW;
+        break;
       }
       // If not stripping spaces we need to keep the last boundary char; note
       // that boundary is advanced when strip_spaces == FALSE in earlier code.
 
       if(
         !strip_spaces && has_boundary && (
-          state_bound.string[state_bound.pos_byte] == ' ' ||
-          state_bound.string[state_bound.pos_byte] == '\t'
+          state_bound.string[state_bound.pos.byte] == ' ' ||
+          state_bound.string[state_bound.pos.byte] == '\t'
         ) &&
-        state_bound.pos_byte < state.pos_byte
+        state_bound.pos.byte < state->pos.byte
       ) {
-        state_bound = FANSI_read_next(state_bound);
+        FANSI_read_next(&state_bound);
       }
-      // Write the string
-
-      res_sxp = PROTECT(
-        FANSI_writeline(
-          state_bound, state_start, buff,
-          para_start ? pre_first : pre_next,
-          width_tar, pad_chr
-        )
-      );
+      // Record the line
+
+      status = wrap_add_line(lines, &state_bound, &state_start, para_start);
+      if(status != WRAP_OK) break;
       first_line = 0;
-      last_start = state_start.pos_byte;
-      // first_only for `strtrim`
+      last_start = state_start.pos.byte;
 
-      if(!first_only) {
-        SETCDR(char_list, list1(res_sxp));
-        char_list = CDR(char_list);
-        UNPROTECT(1);
-      } else break;
-      // overflow should be impossible here since string is at most int long
+      // first_only for `strtrim`
 
-      ++size;
-      if(!state.string[state.pos_byte]) break;
+      if(first_only || !state->string[state->pos.byte]) break;
 
       // Next line will be the beginning of a paragraph
 
-      para_start = (state.string[state.pos_byte] == '\n');
+      para_start = (state->string[state->pos.byte] == '\n');
       width_tar = para_start ? width_1 : width_2;
 
       // Recreate what the state is at the wrap point, including skipping the
@@ -454,56 +467,267 @@ static SEXP strwrap(
       // there are any and we are in strip_space mode.  If there was no boundary
       // then we're hard breaking and we reset position to the next position.
 
-      // Rprintf(
-      //   "Positions has_b: %d, state: %d bound: %d prev: %d next: %d\n",
-      //   has_boundary,
-      //   state.pos_byte, state_bound.pos_byte, state_prev.pos_byte,
-      //   state_next.pos_byte
-      // );
       if(has_boundary && para_start) {
-        state_bound = FANSI_read_next(state_bound);
+        FANSI_read_next(&state_bound);
       } else if(!has_boundary) {
-        state_bound = state;
+        state_bound = *state;
       }
       if(strip_spaces) {
-        while(state_bound.string[state_bound.pos_byte] == ' ') {
-          state_bound = FANSI_read_next(state_bound);
+        while(state_bound.string[state_bound.pos.byte] == ' ') {
+          FANSI_read_next(&state_bound);
       } }
       has_boundary = 0;
-      state_bound.pos_width = 0;
+      state_bound.pos.width = 0;
 
-      state_prev = state;
-      state = state_start = state_bound;
+      *state_prev = *state;
+      *state = state_start = state_bound;
     } else {
+      struct FANSI_state * state_tmp = state_prev;
       state_prev = state;
       state = state_next;
+      state_next = state_tmp;
     }
   }
-  // Convert to string and return; this is a little inefficient for the
-  // `first_only` mode as ideally we would just return a CHARSXP, but for now we
-  // are just trying to keep it simple
+  if(state_bound.warn < state->warn) state->warn = state_bound.warn;
+  *state_end = *state;
+  lines->warned = state_end->warn < 0;
+  return status;
+}
+/*
+ * Write out the lines found by `wrap_find`
+ *
+ * All input strings are expected to be in UTF8 compatible format (i.e. either
+ * encoded in UTF8, or contain only bytes in 0-127).  That way we know we can
+ * set the encoding to UTF8 if there are any bytes greater than 127, or NATIVE
+ * otherwise under the assumption that 0-127 is valid in all encodings.
+ *
+ * @param state_init the state used to find the lines, only the string and the
+ *   flags are used.
+ * @param buff a pointer to a buffer struct.  We use pointer to a
+ *   pointer because it may need to be resized, but we also don't want to
+ *   re-allocate the buffer between calls.
+ * @param pre_first, pre_next, strings (and associated meta data) to prepend to
+ *   each line; pre_first can be based of of `prefix` or off of `initial`
+ *   depending whether we're at the very first line of the external input or not
+ * @param width_1, width_2 see `wrap_find`.
+ */
+static SEXP wrap_write(
+  struct wrap_lines * lines, struct FANSI_state state_init,
+  struct FANSI_prefix_dat pre_first, struct FANSI_prefix_dat pre_next,
+  int width_1, int width_2,
+  struct FANSI_buff * buff, const char * pad_chr
+) {
+  SEXP res = PROTECT(allocVector(STRSXP, lines->len));
+  struct FANSI_state state_start, state_bound;
+  state_start = state_bound = state_init;
+
+  for(R_xlen_t i = 0; i < lines->len; ++i) {
+    struct wrap_line line = lines->lines[i];
+    state_start.sgr = line.sgr_start;
+    state_start.pos.byte = line.byte_start;
+    state_start.pos.width = line.width_start;
+    state_bound.sgr = line.sgr_bound;
+    state_bound.pos.byte = line.byte_bound;
+    state_bound.pos.width = line.width_bound;
+    state_bound.has_utf8 = line.has_utf8;
+
+    SET_STRING_ELT(
+      res, i,
+      FANSI_writeline(
+        state_bound, state_start, buff,
+        line.para_start ? pre_first : pre_next,
+        line.para_start ? width_1 : width_2, pad_chr
+    ) );
+  }
+  UNPROTECT(1);
+  return res;
+}
+static void wrap_narrow_error() {
+  error(
+    "%s%s",
+    "Wrap error: trying to wrap to width narrower than ",
+    "character width; set `wrap.always=FALSE` to resolve."
+  );
+}
+/*
+ * Wrap a single string
+ *
+ * @param state_init initial state with the string to wrap.
+ * @param carry NULL, or the SGR style active at the beginning of the string,
+ *   in which case it is updated to the style active at the end of it.
+ * @param first_only whether to only return the first line as a CHARSXP, for
+ *   `strtrim`
+ * @param lines used to record the lines, its contents are discarded.
+ */
+static SEXP strwrap(
+  struct FANSI_state state_init, int width,
+  struct FANSI_prefix_dat pre_first,
+  struct FANSI_prefix_dat pre_next,
+  int wrap_always,
+  struct FANSI_buff * buff,
+  const char * pad_chr,
+  int strip_spaces,
+  int first_only,
+  struct FANSI_style * carry,
+  struct wrap_lines * lines
+) {
+  int width_1 = FANSI_ADD_INT(width, -pre_first.width);
+  int width_2 = FANSI_ADD_INT(width, -pre_next.width);
 
-  SEXP res;
+  if(width < 1 && wrap_always)
+    error("Internal Error: invalid width."); // nocov
+  if(wrap_always && (width_1 < 0 || width_2 < 0))
+    error("Internal Error: incompatible width/indent/prefix."); // nocov
 
-  if(!first_only) {
-    res = PROTECT(allocVector(STRSXP, size));
-    char_list = char_list_start;
-    for(R_xlen_t i = 0; i < size; ++i) {
-      char_list = CDR(char_list); // first element is NULL
-      if(char_list == R_NilValue)
-        error("Internal Error: wrapped element count mismatch");  // nocov
-      SET_STRING_ELT(res, i, CAR(char_list));
-    }
-    if(CDR(char_list) != R_NilValue)
-      error("Internal Error: wrapped element count mismatch 2");  // nocov
-  } else {
-    // recall there is an extra open PROTECT in first_only mode
-    res = res_sxp;
-  }
-  UNPROTECT(2);
+  if(carry) state_init.sgr = *carry;
+  struct FANSI_state state = state_init;
+  lines->len = 0;
+  int status = wrap_find(
+    &state, width_1, width_2, wrap_always, strip_spaces, first_only, lines
+  );
+  SEXP res = PROTECT(
+    wrap_write(
+      lines, state_init, pre_first, pre_next, width_1, width_2, buff, pad_chr
+  ) );
+  if(status == WRAP_NARROW) wrap_narrow_error();
+  if(carry) *carry = state.sgr;
+  if(first_only) res = STRING_ELT(res, 0);
+  UNPROTECT(1);
   return res;
 }
 
+/*
+ * Wrap elements in parallel
+ *
+ * Worker threads find the lines for a batch of elements, recording them into
+ * space set aside for each element based on an estimate of how many lines it
+ * will need.  The main thread then issues any warnings and errors and writes
+ * the lines out in element order, so results, warnings, and errors are the
+ * same as when wrapping in sequence.  Elements that outgrow their space, that
+ * are too large to be batched, or that need warnings are wrapped again by the
+ * main thread.
+ *
+ * Only the non-`first_only`, non-`carry` case is supported.
+ *
+ * @param warned_res if not NULL, set to whether each element warned.
+ * @param idx if not NULL, the index in the original input of each element of
+ *   `x`, used for error messages.
+ */
+#define WRAP_BATCH_LINES (1 << 17)
+
+static void wrap_parallel(
+  SEXP x, SEXP res, struct FANSI_state state_init, int width,
+  struct FANSI_prefix_dat ini_first, struct FANSI_prefix_dat pre_first,
+  struct FANSI_prefix_dat pre_next,
+  int wrap_always, int strip_spaces,
+  struct FANSI_buff * buff, const char * pad_chr, int threads,
+  int * warned_res, const R_xlen_t * idx
+) {
+  R_xlen_t x_len = XLENGTH(x);
+  int width_ini = FANSI_ADD_INT(width, -ini_first.width);
+  int width_1 = FANSI_ADD_INT(width, -pre_first.width);
+  int width_2 = FANSI_ADD_INT(width, -pre_next.width);
+  if(width < 1 && wrap_always)
+    error("Internal Error: invalid width."); // nocov
+  if(wrap_always && (width_ini < 0 || width_1 < 0 || width_2 < 0))
+    error("Internal Error: incompatible width/indent/prefix."); // nocov
+
+  // Lines in a paragraph are at least half the narrowest width unless there
+  // are wide characters or words that don't fit, in which case we may run out
+  // of space and fall back to the main thread.
+
+  int width_min = width_ini < width_1 ? width_ini : width_1;
+  if(width_2 < width_min) width_min = width_2;
+  int width_est = width_min > 2 ? width_min / 2 : 1;
+
+  struct wrap_line * pool = (struct wrap_line *)
+    R_alloc(WRAP_BATCH_LINES, sizeof(struct wrap_line));
+  int batch_max = WRAP_BATCH_LINES / 2;
+  struct wrap_lines * elts = (struct wrap_lines *)
+    R_alloc(batch_max, sizeof(struct wrap_lines));
+  const char ** chrs = (const char **) R_alloc(batch_max, sizeof(char *));
+  int * status = (int *) R_alloc(batch_max, sizeof(int));
+  int * warned = (int *) R_alloc(batch_max, sizeof(int));
+
+  struct FANSI_state state_thread = state_init;
+  if(state_thread.warn > 0) state_thread.warn = FANSI_WARN_DEFER;
+  struct wrap_lines lines = {.len=0, .size=0, .grow=1};
+
+  R_xlen_t i = 0;
+  while(i < x_len) {
+    // Set aside space for as many elements as will fit in the pool
+
+    R_xlen_t pool_used = 0;
+    int batch_len = 0;
+    for(; i + batch_len < x_len && batch_len < batch_max; ++batch_len) {
+      FANSI_interrupt(i + batch_len);
+      SEXP chr = STRING_ELT(x, i + batch_len);
+      R_xlen_t est = 0;
+      chrs[batch_len] = NULL;
+      if(chr != NA_STRING) {
+        est = LENGTH(chr) / width_est + 2;
+        if(est > WRAP_BATCH_LINES) est = 0; // too big, main thread
+        else if(est > WRAP_BATCH_LINES - pool_used) break;
+        else chrs[batch_len] = CHAR(chr);
+      }
+      elts[batch_len] = (struct wrap_lines) {
+        .lines=pool + pool_used, .len=0, .size=est, .grow=0
+      };
+      status[batch_len] = WRAP_FULL;
+      warned[batch_len] = 0;
+      pool_used += est;
+    }
+    int k;
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(threads) schedule(dynamic, 64)
+#endif
+    for(k = 0; k < batch_len; ++k) {
+      if(!chrs[k]) continue;
+      struct FANSI_state state = state_thread;
+      state.string = chrs[k];
+      status[k] = wrap_find(
+        &state, i + k ? width_1 : width_ini, width_2,
+        wrap_always, strip_spaces, 0, elts + k
+      );
+      warned[k] = state.warn < 0;
+    }
+    // Write out the lines in order
+
+    for(k = 0; k < batch_len; ++k, ++i) {
+      FANSI_interrupt(i);
+      SEXP chr = STRING_ELT(x, i);
+      if(chr == NA_STRING) continue;
+      FANSI_check_enc(chr, idx ? idx[i] : i);
+      struct FANSI_state state = state_init;
+      state.string = CHAR(chr);
+      struct FANSI_prefix_dat pre_i = i ? pre_first : ini_first;
+      SEXP str_i;
+      int warned_i = warned[k];
+
+      // Elements with warnings are re-wrapped to issue them exactly as they
+      // would be when wrapping in sequence
+
+      if(status[k] == WRAP_FULL || warned[k]) {
+        str_i = PROTECT(
+          strwrap(
+            state, width, pre_i, pre_next, wrap_always, buff, pad_chr,
+            strip_spaces, 0, NULL, &lines
+        ) );
+        // Elements too big to batch were not read by the workers
+        warned_i = lines.warned;
+      } else {
+        str_i = PROTECT(
+          wrap_write(
+            elts + k, state, pre_i, pre_next, i ? width_1 : width_ini,
+            width_2, buff, pad_chr
+        ) );
+        if(status[k] == WRAP_NARROW) wrap_narrow_error();
+      }
+      if(warned_res) warned_res[i] = warned_i;
+      SET_VECTOR_ELT(res, i, str_i);
+      UNPROTECT(1);
+  } }
+}
 /*
  * All integer inputs are expected to be positive, which should be enforced by
  * the R interface checks.
@@ -513,6 +737,18 @@ static SEXP strwrap(
  * @param first_only whether we only want the first line of a wrapped element,
  *   this is to support strtrim. If this is true then the return value becomes a
  *   character vector (STRSXP) rather than a VECSXP
+ * @param carry NA to wrap each element independently, or a string, in which
+ *   case the SGR style active at the end of each element carries into the
+ *   next one, starting with the style active at the end of `carry`.  The style
+ *   active at the end of the last element is then attached to the result as
+ *   an SGR string in the "carry" attribute so that it can be fed back in to
+ *   continue from where we left off.  Ignored in `first_only` mode.
+ * @param threads scalar integer number of threads to use to find the lines
+ *   in parallel, see `wrap_parallel`.
+ * @param cache scalar numeric approximate memory budget in bytes of the wrap
+ *   cache (see cache.c), zero to disable and clear it.  The cache is not used
+ *   in `first_only` mode or with `carry`.  Elements that warn are not cached
+ *   so that cache hits never need to warn.
  */
 
 SEXP FANSI_strwrap_ext(
@@ -524,7 +760,7 @@ SEXP FANSI_strwrap_ext(
   SEXP tabs_as_spaces, SEXP tab_stops,
   SEXP warn, SEXP term_cap,
   SEXP first_only,
-  SEXP ctl
+  SEXP ctl, SEXP carry, SEXP threads, SEXP cache
 ) {
   if(
     TYPEOF(x) != STRSXP || TYPEOF(width) != INTSXP ||
@@ -537,7 +773,10 @@ SEXP FANSI_strwrap_ext(
     TYPEOF(tabs_as_spaces) != LGLSXP ||
     TYPEOF(tab_stops) != INTSXP ||
     TYPEOF(first_only) != LGLSXP ||
-    TYPEOF(ctl) != INTSXP
+    TYPEOF(ctl) != INTSXP ||
+    TYPEOF(carry) != STRSXP || XLENGTH(carry) != 1 ||
+    TYPEOF(threads) != INTSXP || XLENGTH(threads) != 1 ||
+    TYPEOF(cache) != REALSXP || XLENGTH(cache) != 1
   )
     error("Internal Error: arg type error 1; contact maintainer.");  // nocov
 
@@ -554,6 +793,68 @@ SEXP FANSI_strwrap_ext(
 
   struct FANSI_buff buff = {.len = 0};
 
+  // Look up cached results, and only wrap the elements that are not cached.
+  // The signature captures all the settings other than prefix and initial.
+
+  int first_only_int = asInteger(first_only);
+  SEXP carry_chr = STRING_ELT(carry, 0);
+  SEXP x_all = x, res_all = R_NilValue;
+  R_xlen_t x_len_all = XLENGTH(x), miss_len = 0;
+  R_xlen_t * miss = NULL;
+  int cache_set = -1, ini_hit = 0;
+
+  if(!first_only_int && (carry_chr == NA_STRING || asReal(cache) <= 0)) {
+    R_xlen_t sig_len = 11 + XLENGTH(term_cap) + XLENGTH(ctl) +
+      XLENGTH(tab_stops);
+    SEXP sig = PROTECT(allocVector(INTSXP, sig_len));
+    int * sig_int = INTEGER(sig);
+    int sig_head[8] = {
+      asInteger(width), asInteger(indent), asInteger(exdent),
+      asInteger(wrap_always), asInteger(strip_spaces),
+      asInteger(tabs_as_spaces), asInteger(warn), (unsigned char) *pad
+    };
+    SEXP sig_vecs[3] = {term_cap, ctl, tab_stops};
+    memcpy(sig_int, sig_head, sizeof(sig_head));
+    sig_int += 8;
+    for(int j = 0; j < 3; ++j) {
+      *(sig_int++) = (int) XLENGTH(sig_vecs[j]);
+      memcpy(
+        sig_int, INTEGER(sig_vecs[j]), XLENGTH(sig_vecs[j]) * sizeof(int)
+      );
+      sig_int += XLENGTH(sig_vecs[j]);
+    }
+    cache_set = FANSI_cache_settings(
+      asReal(cache), sig, STRING_ELT(prefix, 0), STRING_ELT(initial, 0)
+    );
+    UNPROTECT(1);
+  }
+  if(cache_set >= 0) {
+    res_all = PROTECT(allocVector(VECSXP, x_len_all));
+    miss = (R_xlen_t *) R_alloc(x_len_all, sizeof(R_xlen_t));
+    for(R_xlen_t i = 0; i < x_len_all; ++i) {
+      FANSI_interrupt(i);
+      SEXP chr = STRING_ELT(x, i);
+      if(chr == NA_STRING) continue;
+      // Check here as later checks only see the index among the misses
+      FANSI_check_enc(chr, i);
+      SEXP val = FANSI_cache_get(chr, cache_set, i == 0);
+      if(val) SET_VECTOR_ELT(res_all, i, val);
+      else miss[miss_len++] = i;
+    }
+    if(!miss_len) {
+      UNPROTECT(1);
+      return res_all;
+    }
+    // The first element to wrap only uses `initial` if it is the first one
+
+    ini_hit = miss[0] != 0;
+    if(miss_len < x_len_all) {
+      x = PROTECT(allocVector(STRSXP, miss_len));
+      for(R_xlen_t i = 0; i < miss_len; ++i)
+        SET_STRING_ELT(x, i, STRING_ELT(x_all, miss[i]));
+    } else PROTECT(x);
+  } else x = PROTECT(PROTECT(x));  // PROTECT stack balance
+
   // Strip whitespaces as needed; `strwrap` doesn't seem to do this with prefix
   // and initial, so we don't either
 
@@ -586,7 +887,6 @@ SEXP FANSI_strwrap_ext(
   int indent_int = asInteger(indent);
   int exdent_int = asInteger(exdent);
   int warn_int = asInteger(warn);
-  int first_only_int = asInteger(first_only);
 
   if(indent_int < 0 || exdent_int < 0)
     error("Internal Error: illegal indent/exdent values.");  // nocov
@@ -611,6 +911,8 @@ SEXP FANSI_strwrap_ext(
     pre_next_dat = pad_pre(pre_dat_raw, exdent_int);
   } else pre_next_dat = pre_first_dat;
 
+  if(ini_hit) ini_first_dat = pre_first_dat;
+
   // Check that widths are feasible, although really only relevant if in strict
   // mode
 
@@ -630,6 +932,28 @@ SEXP FANSI_strwrap_ext(
       "and `prefix` width must be less than `width - 1` when in `wrap.always`."
     );
 
+  // Read the initial carried style, if any
+
+  struct FANSI_style sgr_carry;
+  struct FANSI_style * sgr_carry_p = NULL;
+  SEXP R_true = PROTECT(ScalarLogical(1));
+  SEXP R_one = PROTECT(ScalarInteger(1));
+
+  if(carry_chr != NA_STRING && !first_only_int) {
+    FANSI_check_enc(carry_chr, 0);
+    struct FANSI_state state_carry = FANSI_state_init_full(
+      CHAR(carry_chr), warn, term_cap, R_true, R_true, R_one, ctl
+    );
+    while(state_carry.string[state_carry.pos.byte])
+      FANSI_read_next(&state_carry);
+    sgr_carry = state_carry.sgr;
+    sgr_carry_p = &sgr_carry;
+  }
+  struct FANSI_state state_init = FANSI_state_init_full(
+    "", warn, term_cap, R_true, R_true, R_one, ctl
+  );
+  UNPROTECT(2);
+
   // Could be a little faster avoiding this allocation if it turns out nothing
   // needs to be wrapped and we're in simplify=TRUE, but that seems like a lot
   // of work for a rare event
@@ -643,34 +967,163 @@ SEXP FANSI_strwrap_ext(
   } else {
     res = PROTECT(allocVector(VECSXP, x_len));
   }
-  // Wrap each element
+  const char * pad_chr = CHAR(asChar(pad_end));
+  struct wrap_lines lines = {.len=0, .size=0, .grow=1};
+  int * warned = cache_set >= 0 ? (int *) R_alloc(x_len, sizeof(int)) : NULL;
+
+  // Elements are independent unless we carry state across them, in which case
+  // they must be wrapped in sequence.
+
+  int threads_int = asInteger(threads);
+#if !defined(_OPENMP) || defined(FANSI_R_WIDTH)
+  threads_int = 1;
+#endif
+  if(threads_int > 1 && !first_only_int && !sgr_carry_p && x_len > 1) {
+    wrap_parallel(
+      x, res, state_init, width_int, ini_first_dat, pre_first_dat,
+      pre_next_dat, wrap_always_int, strip_spaces_int, &buff, pad_chr,
+      threads_int, warned, miss
+    );
+  } else {
+    // Wrap each element
+
+    for(i = 0; i < x_len; ++i) {
+      FANSI_interrupt(i);
+      SEXP chr = STRING_ELT(x, i);
+      if(chr == NA_STRING) continue;
+      FANSI_check_enc(chr, miss ? miss[i] : i);
+      struct FANSI_state state = state_init;
+      state.string = CHAR(chr);
+
+      SEXP str_i = PROTECT(
+        strwrap(
+          state, width_int,
+          i ? pre_first_dat : ini_first_dat,
+          pre_next_dat,
+          wrap_always_int, &buff,
+          pad_chr,
+          strip_spaces_int,
+          first_only_int,
+          sgr_carry_p, &lines
+      ) );
+      if(first_only_int) {
+        SET_STRING_ELT(res, i, str_i);
+      } else {
+        SET_VECTOR_ELT(res, i, str_i);
+      }
+      if(warned) warned[i] = lines.warned;
+      UNPROTECT(1);
+  } }
+  // Cache the newly wrapped elements and merge them with the cached ones
+
+  if(cache_set >= 0) {
+    for(i = 0; i < x_len; ++i) {
+      SEXP str_i = VECTOR_ELT(res, i);
+      if(str_i == R_NilValue) continue;
+      if(!warned[i])
+        FANSI_cache_set(
+          STRING_ELT(x_all, miss[i]), cache_set, miss[i] == 0, str_i
+        );
+      SET_VECTOR_ELT(res_all, miss[i], str_i);
+    }
+    res = res_all;
+  }
+  if(sgr_carry_p) {
+    SEXP carry_end = PROTECT(mkString(FANSI_style_as_chr(sgr_carry)));
+    setAttrib(res, FANSI_carry_sym, carry_end);
+    UNPROTECT(1);
+  }
+  UNPROTECT(7);
+  return res;
+}
+/*
+ * Trim a string to a display width
+ *
+ * Equivalent to `wrap_find` followed by `wrap_write` in `first_only` mode with
+ * `wrap_always`, no prefix, and no padding, but without any of the wrapping
+ * bookkeeping.  We stop reading as soon as the width is reached so the cost
+ * does not depend on how much of the string is left over.
+ */
+static SEXP strtrim(
+  struct FANSI_state state, int width, struct FANSI_buff * buff
+) {
+  struct FANSI_prefix_dat pre_none = {.string=""};
+  struct FANSI_state state_start, state_prev, state_next;
+  state_start = state_prev = state;
+
+  while(1) {
+    if(width > state.pos.width)
+      FANSI_read_ascii(&state, &state_prev, width - state.pos.width, 1);
+    if(!state.string[state.pos.byte]) break;
+
+    state_next = state;
+    FANSI_read_next(&state_next);
+    state.warn = state_next.warn;  // avoid double warning
+
+    // If exactly at width we need to keep going if the next char is zero
+    // width, otherwise we're done
+
+    if(
+      state.pos.width > width ||
+      (state.pos.width == width && state_next.pos.width > state.pos.width)
+    )
+      break;
+
+    state_prev = state;
+    state = state_next;
+  }
+  if(state.pos.width > width) state = state_prev;  // wide char overshoot
 
-  for(i = 0; i < x_len; ++i) {
+  return FANSI_writeline(state, state_start, buff, pre_none, width, "");
+}
+/*
+ * Trim strings to a display width, see `strtrim` above.
+ *
+ * Tabs are converted to spaces on the whole string before trimming.
+ *
+ * @param width scalar integer width to trim to, non-negative.  Like
+ *   `strtrim`, a zero width produces empty strings.
+ */
+SEXP FANSI_strtrim(
+  SEXP x, SEXP width, SEXP tabs_as_spaces, SEXP tab_stops, SEXP warn,
+  SEXP term_cap, SEXP ctl
+) {
+  if(
+    TYPEOF(x) != STRSXP || TYPEOF(width) != INTSXP ||
+    XLENGTH(width) != 1 || TYPEOF(tabs_as_spaces) != LGLSXP ||
+    TYPEOF(tab_stops) != INTSXP || TYPEOF(warn) != LGLSXP ||
+    TYPEOF(term_cap) != INTSXP || TYPEOF(ctl) != INTSXP
+  )
+    error("Internal Error: arg type error 1; contact maintainer.");  // nocov
+
+  int width_int = asInteger(width);
+  if(width_int < 0) error("Internal Error: invalid width."); // nocov
+
+  struct FANSI_buff buff = {.len = 0};
+
+  if(asInteger(tabs_as_spaces))
+    x = PROTECT(FANSI_tabs_as_spaces(x, tab_stops, &buff, warn, term_cap, ctl));
+  else PROTECT(x);
+
+  SEXP R_true = PROTECT(ScalarLogical(1));
+  SEXP R_one = PROTECT(ScalarInteger(1));
+  struct FANSI_state state_init = FANSI_state_init_full(
+    "", warn, term_cap, R_true, R_true, R_one, ctl
+  );
+  UNPROTECT(2);
+
+  R_xlen_t x_len = XLENGTH(x);
+  SEXP res = PROTECT(allocVector(STRSXP, x_len));
+
+  for(R_xlen_t i = 0; i < x_len; ++i) {
     FANSI_interrupt(i);
     SEXP chr = STRING_ELT(x, i);
-    if(chr == NA_STRING) continue;
+    if(chr == NA_STRING || !width_int) continue;  // leave as ""
     FANSI_check_enc(chr, i);
-    const char * chr_utf8 = CHAR(chr);
-
-    SEXP str_i = PROTECT(
-      strwrap(
-        chr_utf8, width_int,
-        i ? pre_first_dat : ini_first_dat,
-        pre_next_dat,
-        wrap_always_int, &buff,
-        CHAR(asChar(pad_end)),
-        strip_spaces_int,
-        warn, term_cap,
-        first_only_int,
-        ctl
-    ) );
-    if(first_only_int) {
-      SET_STRING_ELT(res, i, str_i);
-    } else {
-      SET_VECTOR_ELT(res, i, str_i);
-    }
-    UNPROTECT(1);
+    struct FANSI_state state = state_init;
+    state.string = CHAR(chr);
+    SET_STRING_ELT(res, i, strtrim(state, width_int, &buff));
   }
-  UNPROTECT(5);
+  UNPROTECT(2);
   return res;
 }